@@ -9,6 +9,8 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include <list.h>
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -50,6 +52,9 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* Most sectors a single READ/WRITE SECTOR command can move. */
+#define MAX_PIO_SECTORS 256
+
 /* An ATA device. */
 struct ata_disk
   {
@@ -67,12 +72,28 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    struct lock lock;           /* Guards requests and head. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    struct list requests;       /* Pending ide_requests, by request_key(). */
+    struct condition requests_ready;    /* Signaled when one is queued. */
+    uint32_t head;              /* Key just past the last request served. */
+  };
+
+/* A queued transfer of CNT sectors between BUFFER and disk D. */
+struct ide_request
+  {
+    struct list_elem elem;      /* Element in channel's request list. */
+    struct ata_disk *d;
+    block_sector_t sec_no;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    uint8_t *buffer;
+    bool write;                 /* True for a write, false for a read. */
+    struct semaphore done;      /* Up'd by the dispatcher when finished. */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -85,7 +106,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -95,6 +116,17 @@ static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static void ide_submit (struct ide_request *, struct ata_disk *,
+                        block_sector_t, void *buffer, size_t cnt,
+                        bool write);
+static void ide_wait (struct ide_request *);
+static uint32_t request_key (const struct ide_request *);
+static bool request_less (const struct list_elem *, const struct list_elem *,
+                          void *aux);
+static void ide_dispatcher (void *);
+static void ide_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          struct list *batch, bool write);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
@@ -126,6 +158,9 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      list_init (&c->requests);
+      cond_init (&c->requests_ready);
+      c->head = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -148,6 +183,15 @@ ide_init (void)
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
 
+      /* Start serving requests, which registering a disk below
+         issues when it scans the partition table. */
+      if (c->devices[0].is_ata || c->devices[1].is_ata)
+        {
+          char name[16];
+          snprintf (name, sizeof name, "_%s", c->name);
+          thread_create (name, PRI_MAX, ide_dispatcher, c);
+        }
+
       /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
@@ -337,6 +381,56 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Queues a transfer of CNT sectors between BUFFER and disk D,
+   starting at SEC_NO, and returns at once.  R is the completion
+   handle: the transfer is finished once ide_wait (R) returns. */
+static void
+ide_submit (struct ide_request *r, struct ata_disk *d, block_sector_t sec_no,
+            void *buffer, size_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+
+  ASSERT (cnt > 0 && cnt <= MAX_PIO_SECTORS);
+
+  r->d = d;
+  r->sec_no = sec_no;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->write = write;
+  sema_init (&r->done, 0);
+
+  lock_acquire (&c->lock);
+  list_insert_ordered (&c->requests, &r->elem, request_less, NULL);
+  cond_signal (&c->requests_ready, &c->lock);
+  lock_release (&c->lock);
+}
+
+/* Waits for request R, queued by ide_submit(), to complete. */
+static void
+ide_wait (struct ide_request *r)
+{
+  sema_down (&r->done);
+}
+
+/* Reads or writes CNT sectors starting at SEC_NO between disk D
+   and BUFFER, in requests of up to MAX_PIO_SECTORS each. */
+static void
+ide_rw (struct ata_disk *d, block_sector_t sec_no, uint8_t *buffer,
+        size_t cnt, bool write)
+{
+  while (cnt > 0)
+    {
+      struct ide_request r;
+      size_t n = cnt < MAX_PIO_SECTORS ? cnt : MAX_PIO_SECTORS;
+
+      ide_submit (&r, d, sec_no, buffer, n, write);
+      ide_wait (&r);
+      sec_no += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +438,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_rw (d_, sec_no, buffer, 1, false);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +449,177 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_rw (d_, sec_no, (uint8_t *) buffer, 1, true);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER. */
+static void
+ide_read_multi (void *d_, block_sector_t sec_no, void *buffer, size_t cnt)
+{
+  ide_rw (d_, sec_no, buffer, cnt, false);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER.
+   Returns after the disk has acknowledged receiving all of the
+   data. */
+static void
+ide_write_multi (void *d_, block_sector_t sec_no, const void *buffer,
+                 size_t cnt)
+{
+  ide_rw (d_, sec_no, (uint8_t *) buffer, cnt, true);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
+/* Request scheduling. */
+
+/* Returns the position of request R's first sector in the order
+   the dispatcher sweeps its channel: by disk, then by sector. */
+static uint32_t
+request_key (const struct ide_request *r)
+{
+  return ((uint32_t) r->d->dev_no << 28) | r->sec_no;
+}
+
+/* Orders requests by request_key().  Requests with equal keys
+   keep their arrival order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct ide_request *a = list_entry (a_, struct ide_request, elem);
+  const struct ide_request *b = list_entry (b_, struct ide_request, elem);
+  return request_key (a) < request_key (b);
+}
+
+/* Serves channel C_'s requests with C-LOOK: sweeps upward from
+   the last position served, and wraps around to the lowest
+   pending request at the end.  Requests in the same direction
+   that continue where the previous one ends are merged into a
+   single command.  This thread is the only one that touches the
+   controller once ide_init() has finished identifying disks. */
+static void
+ide_dispatcher (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct list_elem *e;
+      struct ide_request *first, *r;
+      block_sector_t end;
+      size_t cnt;
+
+      lock_acquire (&c->lock);
+      while (list_empty (&c->requests))
+        cond_wait (&c->requests_ready, &c->lock);
+
+      for (e = list_begin (&c->requests); e != list_end (&c->requests);
+           e = list_next (e))
+        if (request_key (list_entry (e, struct ide_request, elem)) >= c->head)
+          break;
+      if (e == list_end (&c->requests))
+        e = list_begin (&c->requests);
+
+      list_init (&batch);
+      first = list_entry (e, struct ide_request, elem);
+      e = list_remove (e);
+      list_push_back (&batch, &first->elem);
+      end = first->sec_no + first->cnt;
+      cnt = first->cnt;
+      while (e != list_end (&c->requests))
+        {
+          r = list_entry (e, struct ide_request, elem);
+          if (r->d != first->d || r->write != first->write
+              || r->sec_no != end || cnt + r->cnt > MAX_PIO_SECTORS)
+            break;
+          e = list_remove (e);
+          list_push_back (&batch, &r->elem);
+          end += r->cnt;
+          cnt += r->cnt;
+        }
+      c->head = ((uint32_t) first->d->dev_no << 28) | end;
+      lock_release (&c->lock);
+
+      ide_transfer (first->d, first->sec_no, cnt, &batch, first->write);
+
+      /* A request may vanish as soon as its waiter wakes up. */
+      while (!list_empty (&batch))
+        {
+          r = list_entry (list_pop_front (&batch), struct ide_request, elem);
+          sema_up (&r->done);
+        }
+    }
+}
+
+/* Moves CNT sectors starting at SEC_NO between disk D and the
+   buffers of the requests in BATCH, which cover those sectors in
+   order, using a single READ SECTOR or WRITE SECTOR command.  The
+   disk interrupts once per sector. */
+static void
+ide_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              struct list *batch, bool write)
+{
+  struct channel *c = d->channel;
+  struct list_elem *e;
+  size_t i = 0;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      size_t j;
+
+      for (j = 0; j < r->cnt; j++, i++)
+        {
+          uint8_t *sector = r->buffer + j * BLOCK_SECTOR_SIZE;
+          if (!write)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              input_sector (c, sector);
+            }
+          else
+            {
+              /* The disk asks for the first sector with DRQ alone
+                 and interrupts after accepting each one. */
+              if (i > 0)
+                sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, sector);
+            }
+        }
+    }
+  if (write)
+    sema_down (&c->completion_wait);
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT to the disk's sector selection
+   registers.  (We use LBA mode.)  A count register of 0 means
+   MAX_PIO_SECTORS. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_PIO_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_PIO_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -20,8 +22,15 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
-/* List of waiting thread */
-static struct list waiting_list;
+/* Sleeping threads, as a binary min-heap on added_ticks:
+   sleepers[0] wakes first.  Every thread takes a page, so there
+   can't be more of them than pages of RAM. */
+static struct thread **sleepers;
+static size_t sleeper_cnt;
+
+/* added_ticks of sleepers[0], or INT64_MAX if nobody sleeps, so
+   that most ticks need not look at the heap. */
+static int64_t next_wakeup;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
@@ -32,6 +41,8 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void sleepers_push (struct thread *t);
+static struct thread *sleepers_pop (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -41,7 +52,10 @@ timer_init (void)
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
   /* project #1 */
-  list_init (&waiting_list);
+  sleepers = malloc (init_ram_pages * sizeof *sleepers);
+  if (sleepers == NULL)
+    PANIC ("can't allocate sleep queue");
+  next_wakeup = INT64_MAX;
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -89,14 +103,44 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-static bool compare(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-  struct thread *t_a = list_entry(a, struct thread, elem);
-  struct thread *t_b = list_entry(b, struct thread, elem);
-  if (t_a->added_ticks < t_b->added_ticks)
-    return 1;
-  if (t_a->added_ticks == t_b->added_ticks)
-    return t_a->priority >= t_b->priority;
-  return 0;
+/* Adds T to the sleep heap.  Interrupts must be off. */
+static void
+sleepers_push (struct thread *t)
+{
+  size_t i = sleeper_cnt++;
+  while (i > 0 && sleepers[(i - 1) / 2]->added_ticks > t->added_ticks)
+    {
+      sleepers[i] = sleepers[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+  sleepers[i] = t;
+}
+
+/* Removes and returns the first thread to wake from the sleep
+   heap, which must not be empty.  Interrupts must be off. */
+static struct thread *
+sleepers_pop (void)
+{
+  struct thread *first = sleepers[0];
+  struct thread *last = sleepers[--sleeper_cnt];
+  size_t i = 0;
+
+  for (;;)
+    {
+      size_t child = 2 * i + 1;
+      if (child >= sleeper_cnt)
+        break;
+      if (child + 1 < sleeper_cnt
+          && sleepers[child + 1]->added_ticks < sleepers[child]->added_ticks)
+        child++;
+      if (sleepers[child]->added_ticks >= last->added_ticks)
+        break;
+      sleepers[i] = sleepers[child];
+      i = child;
+    }
+  if (sleeper_cnt > 0)
+    sleepers[i] = last;
+  return first;
 }
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
@@ -105,7 +149,6 @@ timer_sleep (int64_t ticks)
 {
   /*Give up to another thread during the ticks */
   int64_t start = timer_ticks();
-  /* list_less_func *less = &compare; */
 
   ASSERT (intr_get_level () == INTR_ON);
 
@@ -113,7 +156,9 @@ timer_sleep (int64_t ticks)
   enum intr_level prev_level;
   prev_level = intr_disable();
   cur->added_ticks = start + ticks;
-  list_insert_ordered(&waiting_list, &cur->elem, &compare, NULL);
+  sleepers_push(cur);
+  if (cur->added_ticks < next_wakeup)
+    next_wakeup = cur->added_ticks;
 
   thread_block();
 
@@ -195,18 +240,14 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  struct thread* t_ele;
   ticks++;
 
-  while (!list_empty(&waiting_list)) {
-    t_ele = list_entry(list_front(&waiting_list), struct thread, elem);
-    if (timer_ticks() >= t_ele->added_ticks){
-      list_remove(&t_ele->elem);
-      thread_unblock(t_ele);
-      continue;
-    }
-    break;
+  if (ticks >= next_wakeup) {
+    while (sleeper_cnt > 0 && sleepers[0]->added_ticks <= ticks)
+      thread_unblock(sleepers_pop());
+    next_wakeup = sleeper_cnt > 0 ? sleepers[0]->added_ticks : INT64_MAX;
   }
+  thread_tick ();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -4,19 +4,58 @@
 #include "userprog/syscall.h"
 #include "threads/malloc.h"
 #include "devices/timer.h"
-#include <list.h>
+#include <hash.h>
 #include <string.h>
 #include <stdio.h>
 
-struct list cache_list;
+/* Fixed pool of cache slots, allocated once. */
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Maps (block, sector) to the slot holding it.  cache_lock guards
+   cache_map, the clock hand and each slot's identity, pin count and
+   accessed bit; a slot's own lock guards its buffer and dirty bit. */
+static struct hash cache_map;
 struct lock cache_lock;
 
+/* Signaled whenever a slot's pin count drops to zero. */
+static struct condition cache_unpinned;
+
+/* Clock hand: next slot to be considered for eviction. */
+static int cache_hand;
+
+/* Sectors waiting to be prefetched by the read-ahead thread. */
+#define READ_AHEAD_QUEUE 32
+struct read_ahead_req {
+  struct block *block;
+  block_sector_t sector;
+};
+static struct read_ahead_req ra_queue[READ_AHEAD_QUEUE];
+static int ra_head;
+static int ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_ready;
+
 static void periodic_flush(void *aux UNUSED);
+static void read_ahead_daemon(void *aux UNUSED);
+static unsigned cache_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool cache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
+static struct cache_entry *cache_evict(void);
+static struct cache_entry *cache_get(struct block *block, block_sector_t sector, bool fill, bool write);
+static void cache_put(struct cache_entry *ce, bool write);
 
 void cache_init(void) {
-  list_init(&cache_list);
+  int i;
+  for (i = 0; i < CACHE_SIZE; i++)
+    rwlock_init(&cache[i].lock);
+  hash_init(&cache_map, cache_hash, cache_less, NULL);
   lock_init(&cache_lock);
+  cond_init(&cache_unpinned);
+  cache_hand = 0;
+  lock_init(&ra_lock);
+  cond_init(&ra_ready);
+  ra_head = ra_cnt = 0;
 	thread_create("_flusher", 0, periodic_flush, NULL);
+	thread_create("_readahead", PRI_DEFAULT, read_ahead_daemon, NULL);
 }
 
 static void periodic_flush(void *aux UNUSED){
@@ -26,28 +65,178 @@ static void periodic_flush(void *aux UNUSED){
 	}
 }
 
-void cache_push(struct cache_entry *ce) {
-	if(list_size(&cache_list) == 64)
-		cache_pop();
-  list_push_back(&cache_list, &ce->elem);
+/* Brings queued sectors into the cache so that a sequential reader
+   finds them there instead of waiting on the disk. */
+static void read_ahead_daemon(void *aux UNUSED){
+  struct read_ahead_req req;
+  bool cached;
+	while(1){
+    lock_acquire(&ra_lock);
+    while (ra_cnt == 0)
+      cond_wait(&ra_ready, &ra_lock);
+    req = ra_queue[ra_head];
+    ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+    ra_cnt--;
+    lock_release(&ra_lock);
+
+    /* Don't let a prefetch count as a reference to a sector that
+       is already cached. */
+    lock_acquire(&cache_lock);
+    cached = lookup_cache(req.block, req.sector) != NULL;
+    lock_release(&cache_lock);
+    if (!cached)
+      cache_put(cache_get(req.block, req.sector, 1, 0), 0);
+	}
+}
+
+/* Asks the read-ahead thread to prefetch SECTOR of BLOCK.  Returns
+   at once; the request is dropped if the queue is full. */
+void cache_read_ahead(struct block *block, block_sector_t sector){
+  lock_acquire(&ra_lock);
+  if (ra_cnt < READ_AHEAD_QUEUE) {
+    struct read_ahead_req *req = &ra_queue[(ra_head + ra_cnt) % READ_AHEAD_QUEUE];
+    req->block = block;
+    req->sector = sector;
+    ra_cnt++;
+    cond_signal(&ra_ready, &ra_lock);
+  }
+  lock_release(&ra_lock);
+}
+
+static unsigned cache_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct cache_entry *ce = hash_entry(e, struct cache_entry, elem);
+  return hash_int((int)ce->sector) ^ hash_bytes(&ce->block, sizeof ce->block);
+}
+
+static bool cache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+  const struct cache_entry *ce_a = hash_entry(a, struct cache_entry, elem);
+  const struct cache_entry *ce_b = hash_entry(b, struct cache_entry, elem);
+  if (ce_a->block != ce_b->block)
+    return ce_a->block < ce_b->block;
+  return ce_a->sector < ce_b->sector;
+}
+
+/* Picks a victim with the clock algorithm: pinned slots are
+   skipped, referenced slots lose their accessed bit and get a
+   second chance.  Waits for an unpin if every slot is pinned.
+
+   A clean victim is removed from cache_map and returned.  A dirty
+   one is written back with cache_lock dropped, so other lookups
+   keep going during the disk write, and NULL is returned; the
+   caller must then redo its lookup.  Must be called with
+   cache_lock held. */
+static struct cache_entry *cache_evict(void) {
+  struct cache_entry *ce;
+  int scanned = 0;
+  for (;;) {
+    ce = &cache[cache_hand];
+    cache_hand = (cache_hand + 1) % CACHE_SIZE;
+    if (!ce->valid)
+      break;
+    if (ce->pin_cnt == 0) {
+      if (!ce->accessed)
+        break;
+      ce->accessed = 0;
+    }
+    /* Two full sweeps clear every accessed bit, so only pins can
+       keep us here. */
+    if (++scanned >= 2 * CACHE_SIZE) {
+      cond_wait(&cache_unpinned, &cache_lock);
+      scanned = 0;
+    }
+  }
+  if (ce->valid && ce->dirty) {
+    ce->pin_cnt++;
+    lock_release(&cache_lock);
+    rwlock_acquire_read(&ce->lock);
+    cache_block_write(ce);
+    rwlock_release_read(&ce->lock);
+    lock_acquire(&cache_lock);
+    if (--ce->pin_cnt == 0)
+      cond_broadcast(&cache_unpinned, &cache_lock);
+    return NULL;
+  }
+  if (ce->valid) {
+    hash_delete(&cache_map, &ce->elem);
+    ce->valid = 0;
+  }
+  return ce;
+}
+
+/* Returns the slot holding SECTOR of BLOCK, pinned and with its
+   lock held for writing if WRITE is true or for reading otherwise.
+   On a miss the sector is read in unless FILL is false, meaning
+   the caller is about to overwrite all of it.  cache_lock is only
+   held for the lookup; the disk read happens under the slot's own
+   lock, so hits on other sectors proceed meanwhile.  Release with
+   cache_put(). */
+static struct cache_entry *cache_get(struct block *block, block_sector_t sector, bool fill, bool write) {
+  struct cache_entry *ce;
+  lock_acquire(&cache_lock);
+  while ((ce = lookup_cache(block, sector)) == NULL) {
+    ce = cache_evict();
+    if (ce == NULL)
+      continue;
+    /* Publish the slot before dropping cache_lock, so concurrent
+       lookups of SECTOR wait on its lock for the read to finish. */
+    ce->block = block;
+    ce->sector = sector;
+    ce->valid = 1;
+    ce->dirty = 0;
+    /* A sector touched only once, such as streaming file data,
+       stays unreferenced and is the first to go. */
+    ce->accessed = 0;
+    ce->pin_cnt = 1;
+    hash_insert(&cache_map, &ce->elem);
+    /* The slot was unpinned, so nobody holds its lock. */
+    rwlock_acquire_write(&ce->lock);
+    lock_release(&cache_lock);
+    if (fill)
+      cache_block_read(ce);
+    if (!write) {
+      rwlock_release_write(&ce->lock);
+      rwlock_acquire_read(&ce->lock);
+    }
+    return ce;
+  }
+  ce->accessed = 1;
+  ce->pin_cnt++;
+  lock_release(&cache_lock);
+  if (write)
+    rwlock_acquire_write(&ce->lock);
+  else
+    rwlock_acquire_read(&ce->lock);
+  return ce;
 }
 
-void cache_pop(void) {
-  struct cache_entry *ce = NULL;
-  ce = list_entry(list_pop_front(&cache_list), struct cache_entry, elem);
-  cache_block_write(ce);
-  free(ce);
+/* Releases a slot obtained from cache_get(). */
+static void cache_put(struct cache_entry *ce, bool write) {
+  if (write)
+    rwlock_release_write(&ce->lock);
+  else
+    rwlock_release_read(&ce->lock);
+  cache_unpin(ce);
 }
 
+/* Writes every dirty slot back to disk.  Each slot is pinned and
+   read-locked on its own, so the flush does not stall other
+   cache users. */
 void cache_flush(void){
-	struct list_elem *e;
-	struct cache_entry *ce = NULL;
-	lock_acquire(&cache_lock);
-  for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)){
-    ce = list_entry(e, struct cache_entry, elem);
+  int i;
+  for (i = 0; i < CACHE_SIZE; i++) {
+    struct cache_entry *ce = &cache[i];
+    lock_acquire(&cache_lock);
+    if (!ce->valid || !ce->dirty) {
+      lock_release(&cache_lock);
+      continue;
+    }
+    ce->pin_cnt++;
+    lock_release(&cache_lock);
+    rwlock_acquire_read(&ce->lock);
     cache_block_write(ce);
-	}
-	lock_release(&cache_lock);
+    rwlock_release_read(&ce->lock);
+    cache_unpin(ce);
+  }
 }
 
 void cache_block_read(struct cache_entry *ce){
@@ -62,45 +251,59 @@ void cache_block_write(struct cache_entry *ce){
 }
 
 void read_cache(struct block *block, block_sector_t sector, void *buffer){
-	lock_acquire(&cache_lock);
-	struct cache_entry *ce = lookup_cache(block, sector);
-	if(!ce){
-		ce = (struct cache_entry *)calloc(1, sizeof(struct cache_entry));
-		ce->block = block;
-		ce->sector = sector;
-		cache_block_read(ce);
-		// block_read(block, sector, ce->buffer);
-		cache_push(ce);
-		ce->dirty = 0;
-	}
-	memcpy(buffer, ce->buffer, BUF_SIZE);
-	lock_release(&cache_lock);
+  read_cache_at(block, sector, buffer, 0, BUF_SIZE);
 }
 
 void write_cache(struct block *block, block_sector_t sector, const void *buffer){
-	lock_acquire(&cache_lock);
-	struct cache_entry *ce = lookup_cache(block, sector);
-	if(!ce){
-		ce = (struct cache_entry *)calloc(1, sizeof(struct cache_entry));
-		ce->block = block;
-		ce->sector = sector;
-		cache_push(ce);
-		ce->dirty = 0;
-	}
-	memcpy(ce->buffer, buffer, BUF_SIZE);
+  write_cache_at(block, sector, buffer, 0, BUF_SIZE);
+}
+
+/* Copies SIZE bytes at offset OFS of SECTOR into BUFFER.  BUFFER
+   must be kernel memory: a fault on it would be taken with the slot
+   locked. */
+void read_cache_at(struct block *block, block_sector_t sector, void *buffer, int ofs, int size){
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BUF_SIZE);
+	struct cache_entry *ce = cache_get(block, sector, 1, 0);
+	memcpy(buffer, ce->buffer + ofs, size);
+	cache_put(ce, 0);
+}
+
+/* Copies SIZE bytes from BUFFER, which must be kernel memory, into
+   SECTOR at offset OFS. The sector only reaches the disk when it is
+   evicted or flushed. */
+void write_cache_at(struct block *block, block_sector_t sector, const void *buffer, int ofs, int size){
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BUF_SIZE);
+	struct cache_entry *ce = cache_get(block, sector, size < BUF_SIZE, 1);
+	memcpy(ce->buffer + ofs, buffer, size);
 	ce->dirty = 1;
-	cache_block_write(ce);
-	lock_release(&cache_lock);
+	cache_put(ce, 1);
 }
 
+/* Finds the slot holding SECTOR of BLOCK in O(1), or returns NULL.
+   Must be called with cache_lock held, which also guards KEY. */
 struct cache_entry *lookup_cache(struct block *block, block_sector_t sector){
-	struct list_elem *e;
-	struct cache_entry *ce = NULL;
-  for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)) {
-    ce = list_entry(e, struct cache_entry, elem);
-    if(ce->block == block && ce->sector == sector){
-    	return ce;
-    }
-  }
-  return NULL;
+  static struct cache_entry key;
+  struct hash_elem *e;
+  key.block = block;
+  key.sector = sector;
+  e = hash_find(&cache_map, &key.elem);
+  return e != NULL ? hash_entry(e, struct cache_entry, elem) : NULL;
+}
+
+/* Returns the slot holding SECTOR of BLOCK with its pin count
+   raised, so the slot stays bound to SECTOR until the matching
+   cache_unpin().  Its buffer must still be accessed under the
+   slot's lock. */
+struct cache_entry *cache_pin(struct block *block, block_sector_t sector){
+	struct cache_entry *ce = cache_get(block, sector, 1, 0);
+	rwlock_release_read(&ce->lock);
+	return ce;
+}
+
+void cache_unpin(struct cache_entry *ce){
+	lock_acquire(&cache_lock);
+	ASSERT (ce->pin_cnt > 0);
+	if (--ce->pin_cnt == 0)
+		cond_broadcast(&cache_unpinned, &cache_lock);
+	lock_release(&cache_lock);
 }
@@ -1,24 +1,36 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
 #include "devices/block.h"
 #include "threads/synch.h"
-#include <list.h>
+#include <hash.h>
 
 #define BUF_SIZE 512
+#define CACHE_SIZE 64
 
 struct cache_entry {
     struct block *block;
-    // struct lock lock;
     block_sector_t sector;
+    bool valid;                 /* True if this slot holds a sector. */
     bool dirty;
+    bool accessed;              /* Referenced since the hand last passed. */
+    int pin_cnt;                /* >0: must not be evicted. */
+    struct rwlock lock;         /* Guards buffer and dirty. */
     char buffer[BUF_SIZE];
-    struct list_elem elem;
+    struct hash_elem elem;      /* Element in cache_map. */
 };
 
 void cache_init(void);
-void cache_push(struct cache_entry *ce);
-void cache_pop(void);
 void cache_flush(void);
 void cache_block_read(struct cache_entry *ce);
 void cache_block_write(struct cache_entry *ce);
 void read_cache(struct block *block, block_sector_t sector, void *buffer);
 void write_cache(struct block *block, block_sector_t sector, const void *buffer);
+void read_cache_at(struct block *block, block_sector_t sector, void *buffer, int ofs, int size);
+void write_cache_at(struct block *block, block_sector_t sector, const void *buffer, int ofs, int size);
 struct cache_entry *lookup_cache(struct block *block, block_sector_t sector);
+struct cache_entry *cache_pin(struct block *block, block_sector_t sector);
+void cache_unpin(struct cache_entry *ce);
+void cache_read_ahead(struct block *block, block_sector_t sector);
+
+#endif /* filesys/cache.h */
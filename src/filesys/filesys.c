@@ -36,6 +36,8 @@ filesys_init (bool format)
 
   if (format) 
     do_format ();
+  else
+    inode_load_format (FREE_MAP_SECTOR);
 
   free_map_open ();
 
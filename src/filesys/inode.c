@@ -2,6 +2,7 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include "filesys/filesys.h"
@@ -23,6 +24,34 @@
 
 #define MAX_SIZE 8*1024*8192
 
+/* Number of sectors prefetched past a sequential read. */
+#define READ_AHEAD_SECTORS 8
+
+/* On-disk inode formats, chosen when the file system is formatted. */
+#define INODE_BLOCK_MAP 0               /* Direct/indirect block map. */
+#define INODE_EXTENTS 1                 /* Runs of contiguous sectors. */
+#define EXTENT_CNT 52
+#define EXT_BLOCK_CNT 63
+
+/* A run of LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;
+    uint32_t length;
+  };
+
+/* Overflow extent sector.  Runs past the first EXTENT_CNT are kept
+   in a chain of these, starting at inode_disk's ext_next.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next overflow sector, or 0. */
+    struct extent extents[EXT_BLOCK_CNT];
+    uint32_t unused[1];                 /* Not used. */
+  };
+
+bool inode_extents;
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
@@ -34,7 +63,10 @@ struct inode_disk
     uint32_t direct_index;
     uint32_t indirect_index;
     uint32_t d_indirect_index;
-    uint32_t unused[107];               /* Not used. */   // TODO 111? no 110?
+    uint32_t format;                    /* INODE_BLOCK_MAP or INODE_EXTENTS. */
+    uint32_t extent_cnt;                /* Extents in use. */
+    struct extent extents[EXTENT_CNT];  /* Data runs, in file order. */
+    block_sector_t ext_next;            /* First overflow extent sector, or 0. */
     block_sector_t parent;
     block_sector_t blocks[BLOCK_NUMBER];
   };
@@ -73,6 +105,7 @@ struct inode
     struct list_elem elem;              /* Element in inode list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool busy;                          /* Being read in or written back. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     // struct inode_disk data;             /* Inode content. */
@@ -82,10 +115,26 @@ struct inode
     uint32_t direct_index;
     uint32_t indirect_index;
     uint32_t d_indirect_index;
-    struct lock i_lock;
+    struct rwlock i_lock;               /* Shared by readers and in-place
+                                           writers, exclusive to growth. */
     int isdir;
     block_sector_t parent;
     block_sector_t blocks[BLOCK_NUMBER];
+    // read-ahead
+    off_t ra_next;                      /* Offset just past the last read. */
+    off_t ra_end;                       /* Prefetch already requested up to here. */
+    // decoded index blocks, loaded on first use
+    struct lock index_lock;             /* Guards the three members below. */
+    struct indirect_block *indirect;    /* Copy of the indirect block. */
+    struct indirect_block *d_indirect;  /* Copy of the double-indirect block. */
+    struct indirect_block **d_blocks;   /* Copies of the blocks it points to. */
+    // extents, guarded by index_lock
+    uint32_t format;                    /* INODE_BLOCK_MAP or INODE_EXTENTS. */
+    uint32_t extent_cnt;
+    struct extent *extents;             /* extent_cap() runs, or NULL. */
+    uint32_t *ext_first;                /* First file sector of each run. */
+    block_sector_t *ext_blocks;         /* Overflow extent sectors, in order. */
+    uint32_t ext_block_cnt;
   };
 
 struct indirect_block{
@@ -97,53 +146,172 @@ void check_dalloc(struct inode *inode);
 void dalloc_indirect (block_sector_t *blocks, size_t remain_sectors);
 void dalloc_d_indirect(block_sector_t *blocks, size_t indirect_block, size_t sectors);
 off_t grow_inode(struct inode *inode, off_t length);
+static size_t extent_grow (struct extent *extents, uint32_t *extent_cnt,
+                           uint32_t max, size_t n_sectors);
+static void extent_release (struct extent *extents, uint32_t extent_cnt);
+static void extent_index (struct inode *inode);
+static uint32_t extent_cap (const struct inode *inode);
+static bool extent_add_block (struct inode *inode, block_sector_t sector);
+static bool extent_load (struct inode *inode, block_sector_t next);
+static void extent_store (struct inode *inode);
 size_t add_indirect_block(struct inode *inode, size_t n_sectors);
 size_t add_dindirect_block(struct inode *inode, size_t n_sectors);
 size_t add_ddindirect_block(struct inode *inode, size_t n_sectors, struct indirect_block *i_block);
 
+/* Returns entry IDX of the index block at SECTOR.  The block is
+   pinned in the buffer cache only while the entry is read, instead
+   of being copied out whole. */
+static block_sector_t
+index_block_entry (block_sector_t sector, int idx)
+{
+  struct cache_entry *ce = cache_pin(fs_device, sector);
+  block_sector_t entry;
+  rwlock_acquire_read(&ce->lock);
+  entry = ((block_sector_t *) ce->buffer)[idx];
+  rwlock_release_read(&ce->lock);
+  cache_unpin(ce);
+  return entry;
+}
+
+/* Returns the index block at SECTOR as cached in *SLOT, reading
+   it through the buffer cache on first use.  Returns NULL if
+   memory for the copy can't be had. */
+static block_sector_t *
+index_block_load (struct indirect_block **slot, block_sector_t sector)
+{
+  if (*slot == NULL)
+    {
+      struct indirect_block *i_block = malloc (sizeof *i_block);
+      if (i_block == NULL)
+        return NULL;
+      read_cache(fs_device, sector, i_block);
+      *slot = i_block;
+    }
+  return (*slot)->blocks;
+}
+
+/* Frees INODE's cached index blocks, so that they are read again
+   after grow_inode() has changed them on disk.  Must be called with
+   INODE's index_lock held, or once nobody else can use INODE. */
+static void
+inode_drop_index (struct inode *inode)
+{
+  int i;
+
+  free (inode->indirect);
+  inode->indirect = NULL;
+  free (inode->d_indirect);
+  inode->d_indirect = NULL;
+  if (inode->d_blocks != NULL)
+    {
+      for (i = 0; i < INDIRECT_BLOCKS; i++)
+        free (inode->d_blocks[i]);
+      free (inode->d_blocks);
+      inode->d_blocks = NULL;
+    }
+}
+
+/* Returns the disk sector holding file sector IDX of extent-based
+   INODE, found by binary search over the first file sector of
+   each run.  Must be called with INODE's index_lock held. */
+static block_sector_t
+extent_to_sector (const struct inode *inode, uint32_t idx)
+{
+  int lo = 0;
+  int hi = inode->extent_cnt - 1;
+
+  ASSERT (inode->extent_cnt > 0);
+  while (lo < hi)
+    {
+      int mid = (lo + hi + 1) / 2;
+      if (inode->ext_first[mid] <= idx)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+  return inode->extents[lo].start + (idx - inode->ext_first[lo]);
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.
+   Index blocks are decoded once and kept in INODE, so after the
+   first access every lookup is done in memory; if that memory
+   can't be had, the entry is read from the buffer cache instead. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t length, off_t pos) 
+byte_to_sector (struct inode *inode, off_t length, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < length){
     int idx;
-    block_sector_t indirect_block[INDIRECT_BLOCKS];
+    block_sector_t *table;
+    block_sector_t sector;
+    if (inode->format == INODE_EXTENTS){
+      lock_acquire(&inode->index_lock);
+      sector = extent_to_sector(inode, pos/BLOCK_SECTOR_SIZE);
+      lock_release(&inode->index_lock);
+      return sector;
+    }
     // in DIRECT_BLOCK size (0 ~ 10*512)
     if (pos < BLOCK_SECTOR_SIZE*DIRECT_BLOCKS){
       return inode->blocks[pos/BLOCK_SECTOR_SIZE];
     }
+    lock_acquire(&inode->index_lock);
     // in INDIRECT_BLOCK size (10*512 ~ 512*128 + 10*512) 
-    else if (pos < (BLOCK_SECTOR_SIZE*DIRECT_BLOCKS + BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS*1)){
+    if (pos < (BLOCK_SECTOR_SIZE*DIRECT_BLOCKS + BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS*1)){
       pos -= BLOCK_SECTOR_SIZE*DIRECT_BLOCKS;
       idx = pos/(BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS) + DIRECT_BLOCKS;
-      // read the 11th block(double_indirect_block)
-      block_read(fs_device, inode->blocks[idx], &indirect_block);
+      // look up the 11th block(indirect_block)
       pos = pos%(BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS);
-      return indirect_block[pos/BLOCK_SECTOR_SIZE];
+      table = index_block_load(&inode->indirect, inode->blocks[idx]);
+      if (table)
+        sector = table[pos/BLOCK_SECTOR_SIZE];
+      else
+        sector = index_block_entry(inode->blocks[idx], pos/BLOCK_SECTOR_SIZE);
     }
     // in DOUBLE_INDIRECT_BLOCK size (512*128 + 10*512 ~ 512*128*128 + 512*128 + 10*512) 
     else{
-      // read the 12th block(double_indirect_block)
-      block_read(fs_device, inode->blocks[DIRECT_BLOCKS + 1], &indirect_block);
+      block_sector_t indirect_sector;
       pos -= (BLOCK_SECTOR_SIZE*DIRECT_BLOCKS + BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS*1);
       idx = pos/(BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS);
-      // read the indirect_block in the 12th block(double_indirect_block)
-      block_read(fs_device, indirect_block[idx], &indirect_block);
       pos = pos%(BLOCK_SECTOR_SIZE*INDIRECT_BLOCKS);
-      return indirect_block[pos/BLOCK_SECTOR_SIZE];
+      // look up the 12th block(double_indirect_block)
+      table = index_block_load(&inode->d_indirect, inode->blocks[DIRECT_BLOCKS + 1]);
+      if (table)
+        indirect_sector = table[idx];
+      else
+        indirect_sector = index_block_entry(inode->blocks[DIRECT_BLOCKS + 1], idx);
+      // look up the indirect_block in the 12th block(double_indirect_block)
+      if (inode->d_blocks == NULL)
+        inode->d_blocks = calloc (INDIRECT_BLOCKS, sizeof *inode->d_blocks);
+      table = inode->d_blocks ? index_block_load(&inode->d_blocks[idx], indirect_sector) : NULL;
+      if (table)
+        sector = table[pos/BLOCK_SECTOR_SIZE];
+      else
+        sector = index_block_entry(indirect_sector, pos/BLOCK_SECTOR_SIZE);
     }
+    lock_release(&inode->index_lock);
+    return sector;
   }
   else
     return -1;
 }
 
 bool check_alloc (struct inode_disk *disk_inode){
+  if (disk_inode->format == INODE_EXTENTS){
+    size_t sectors = bytes_to_sectors(disk_inode->length);
+    if (extent_grow(disk_inode->extents, &disk_inode->extent_cnt, EXTENT_CNT,
+                    sectors) != 0){
+      extent_release(disk_inode->extents, disk_inode->extent_cnt);
+      return false;
+    }
+    return true;
+  }
+
   struct inode inode;
   inode.length = 0;
+  inode.format = INODE_BLOCK_MAP;
   inode.direct_index = 0;
   inode.indirect_index = 0;
   inode.d_indirect_index = 0;
@@ -157,14 +325,75 @@ bool check_alloc (struct inode_disk *disk_inode){
 }
 
 /* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
+   returns the same `struct inode'.  open_inodes_lock guards it
+   and every inode's open_cnt and busy flag.  A busy inode stays
+   listed while its first opener reads it in or its last closer
+   writes it back, both without the lock; openers of its sector
+   wait on inode_ready meanwhile. */
 static struct list open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_ready;
+
+static struct inode *open_inode_find (block_sector_t sector);
+static void open_inode_done (struct inode *inode, bool remove);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_ready);
+}
+
+/* Returns the listed inode for SECTOR, or NULL, once it is not
+   busy.  Must be called with open_inodes_lock held. */
+static struct inode *
+open_inode_find (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes); )
+    {
+      struct inode *inode = list_entry (e, struct inode, elem);
+      if (inode->sector != sector)
+        e = list_next (e);
+      else if (inode->busy)
+        {
+          /* The list may change while we wait. */
+          cond_wait (&inode_ready, &open_inodes_lock);
+          e = list_begin (&open_inodes);
+        }
+      else
+        return inode;
+    }
+  return NULL;
+}
+
+/* Clears INODE's busy flag, taking it off the list if REMOVE, and
+   wakes up openers waiting for it. */
+static void
+open_inode_done (struct inode *inode, bool remove)
+{
+  lock_acquire (&open_inodes_lock);
+  inode->busy = false;
+  if (remove)
+    list_remove (&inode->elem);
+  cond_broadcast (&inode_ready, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
+}
+
+/* Makes new inodes use the same format as the inode at SECTOR,
+   for a file system that was formatted on an earlier boot. */
+void
+inode_load_format (block_sector_t sector)
+{
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+  if (disk_inode == NULL)
+    PANIC ("can't read inode format");
+  read_cache(fs_device, sector, disk_inode);
+  inode_extents = disk_inode->format == INODE_EXTENTS;
+  free (disk_inode);
 }
 
 // For Proj.#4
@@ -188,6 +417,7 @@ inode_create (block_sector_t sector, off_t length, int isdir)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
@@ -200,8 +430,9 @@ inode_create (block_sector_t sector, off_t length, int isdir)
       disk_inode->magic = INODE_MAGIC;
       disk_inode->isdir = isdir;
       disk_inode->parent = ROOT_DIR_SECTOR;
+      disk_inode->format = inode_extents ? INODE_EXTENTS : INODE_BLOCK_MAP;
       if(check_alloc(disk_inode)){
-        block_write(fs_device, sector, disk_inode);
+        write_cache(fs_device, sector, disk_inode);
         success = true;
       }
       // // memset(disk_inode->blocks, INIT_SECTOR, BLOCK_NUMBER * sizeof(block_sector_t));
@@ -231,37 +462,46 @@ inode_create (block_sector_t sector, off_t length, int isdir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  inode = open_inode_find (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
+  /* Initialize.  It is listed busy, so that other openers of SECTOR
+     wait for it to be read in instead of reading it themselves. */
   list_push_front (&open_inodes, &inode->elem);
-  lock_init(&inode->i_lock);
+  inode->busy = true;
+  lock_release (&open_inodes_lock);
+  rwlock_init(&inode->i_lock);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  lock_init(&inode->index_lock);
+  inode->indirect = NULL;
+  inode->d_indirect = NULL;
+  inode->d_blocks = NULL;
 
   // write the inode in this inode_disk
   struct inode_disk inode_disk;
-  block_read(fs_device, inode->sector, &inode_disk);
+  read_cache(fs_device, inode->sector, &inode_disk);
   inode->direct_index = inode_disk.direct_index;
   inode->indirect_index = inode_disk.indirect_index;
   inode->d_indirect_index = inode_disk.d_indirect_index;
@@ -270,6 +510,29 @@ inode_open (block_sector_t sector)
   inode->isdir = inode_disk.isdir;
   inode->parent = inode_disk.parent;
   memcpy(&inode->blocks, &inode_disk.blocks, sizeof(block_sector_t)*BLOCK_NUMBER);
+  inode->format = inode_disk.format;
+  inode->extent_cnt = 0;
+  inode->extents = NULL;
+  inode->ext_first = NULL;
+  inode->ext_blocks = NULL;
+  inode->ext_block_cnt = 0;
+  if (inode->format == INODE_EXTENTS){
+    inode->extents = malloc(EXTENT_CNT * sizeof *inode->extents);
+    inode->ext_first = malloc(EXTENT_CNT * sizeof *inode->ext_first);
+    if (inode->extents == NULL || inode->ext_first == NULL
+        || !extent_load(inode, inode_disk.ext_next)){
+      open_inode_done (inode, true);
+      free(inode->extents);
+      free(inode->ext_first);
+      free(inode->ext_blocks);
+      free(inode);
+      return NULL;
+    }
+    inode->extent_cnt = inode_disk.extent_cnt;
+    memcpy(inode->extents, inode_disk.extents, sizeof inode_disk.extents);
+    extent_index(inode);
+  }
+  open_inode_done (inode, false);
   return inode;
 }
 
@@ -278,7 +541,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -318,33 +585,61 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0){
-    /* Remove from inode list and release lock. */
-    list_remove (&inode->elem);
-
-    /* Deallocate blocks if removed. */
-    if (inode->removed) {
-        free_map_release (inode->sector, 1);
-        check_dalloc(inode);
+  /* Release resources if this was the last opener.  The inode
+     stays listed, busy, until it is written back, so a new opener
+     of its sector waits and then reads what it left. */
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
+    {
+      lock_release (&open_inodes_lock);
+      return;
     }
-    else {
-      struct inode_disk disk_inode;
-      disk_inode.direct_index = inode->direct_index;
-      disk_inode.indirect_index = inode->indirect_index;
-      disk_inode.d_indirect_index = inode->d_indirect_index;
-      disk_inode.length = inode->length;
-      disk_inode.magic = INODE_MAGIC;
-      disk_inode.isdir = inode->isdir;
-      disk_inode.parent = inode->parent;
-      memcpy(&disk_inode.blocks, &inode->blocks, BLOCK_NUMBER*sizeof(block_sector_t));
-      block_write(fs_device, inode->sector, &disk_inode);
+  inode->busy = true;
+  lock_release (&open_inodes_lock);
+
+  /* Deallocate blocks if removed. */
+  if (inode->removed) {
+      free_map_release (inode->sector, 1);
+      check_dalloc(inode);
+  }
+  else {
+    struct inode_disk disk_inode;
+    disk_inode.direct_index = inode->direct_index;
+    disk_inode.indirect_index = inode->indirect_index;
+    disk_inode.d_indirect_index = inode->d_indirect_index;
+    disk_inode.length = inode->length;
+    disk_inode.magic = INODE_MAGIC;
+    disk_inode.isdir = inode->isdir;
+    disk_inode.parent = inode->parent;
+    memcpy(&disk_inode.blocks, &inode->blocks, BLOCK_NUMBER*sizeof(block_sector_t));
+    disk_inode.format = inode->format;
+    disk_inode.extent_cnt = inode->extent_cnt;
+    disk_inode.ext_next = 0;
+    if (inode->format == INODE_EXTENTS){
+      memcpy(disk_inode.extents, inode->extents, sizeof disk_inode.extents);
+      if (inode->ext_block_cnt > 0)
+        disk_inode.ext_next = inode->ext_blocks[0];
+      extent_store(inode);
     }
-    free (inode); 
+    write_cache(fs_device, inode->sector, &disk_inode);
   }
+  inode_drop_index(inode);
+  open_inode_done (inode, true);
+  free (inode->extents);
+  free (inode->ext_first);
+  free (inode->ext_blocks);
+  free (inode);
 }
 
 void check_dalloc(struct inode *inode){
+  if (inode->format == INODE_EXTENTS){
+    uint32_t i;
+    extent_release(inode->extents, inode->extent_cnt);
+    for (i = 0; i < inode->ext_block_cnt; i++)
+      free_map_release(inode->ext_blocks[i], 1);
+    return;
+  }
+
   size_t sectors = bytes_to_sectors(inode->length);
   size_t indirect_block = check_indirect_block(inode->length);
   size_t d_indirect_block = check_d_indirect_block(inode->length);
@@ -376,7 +671,7 @@ void check_dalloc(struct inode *inode){
 void dalloc_indirect (block_sector_t *blocks, size_t remain_sectors){
   uint32_t n = 0;
   struct indirect_block i_block;
-  block_read(fs_device, *blocks, &i_block);
+  read_cache(fs_device, *blocks, &i_block);
   while (n < remain_sectors){
     free_map_release(i_block.blocks[n], 1);
     n ++;
@@ -387,7 +682,7 @@ void dalloc_indirect (block_sector_t *blocks, size_t remain_sectors){
 void dalloc_d_indirect(block_sector_t *blocks, size_t indirect_block, size_t sectors){
   uint32_t n = 0;
   struct indirect_block i_block;
-  block_read(fs_device, *blocks, &i_block);
+  read_cache(fs_device, *blocks, &i_block);
   while (n < indirect_block){
     size_t remain_sectors = sectors < INDIRECT_BLOCKS ? sectors : INDIRECT_BLOCKS;
     dalloc_indirect(&i_block.blocks[n], remain_sectors);
@@ -406,9 +701,29 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Queues the sectors that follow OFFSET in INODE for read-ahead,
+   skipping those already requested. */
+static void
+inode_read_ahead (struct inode *inode, off_t length, off_t offset)
+{
+  off_t pos = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  off_t limit = pos + READ_AHEAD_SECTORS * BLOCK_SECTOR_SIZE;
+
+  if (limit > length)
+    limit = length;
+  if (pos < inode->ra_end)
+    pos = inode->ra_end;
+  for (; pos < limit; pos += BLOCK_SECTOR_SIZE)
+    cache_read_ahead(fs_device, byte_to_sector(inode, length, pos));
+  if (limit > inode->ra_end)
+    inode->ra_end = limit;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Readers of one inode run side by side; the read-ahead hints
+   they share are only hints, so races on them are harmless. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
@@ -416,12 +731,15 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   //   printf("inode_read_at(): tid(%d), sector(%d), buffer_(%s), size(%d), offset(%d)\n", thread_current()->tid, inode->sector, (const char *)buffer_, size, offset);
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential = offset == inode->ra_next;
+  off_t length;
 
-  off_t length = inode->read_length;
+  rwlock_acquire_read(&inode->i_lock);
+  length = inode->read_length;
   // printf("inode_read_at(): offset(%d), length(%d)\n", offset, length);
 
   if (offset >= length){
+    rwlock_release_read(&inode->i_lock);
     return bytes_read;
   }
 
@@ -442,31 +760,25 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read(fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-           /*Read sector into bounce buffer, then partially copy
-             into caller's buffer. */  
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read(fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache. */
+      read_cache_at(fs_device, sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* A read that picks up where the last one ended is taken as a
+     sequential scan, and the sectors after it are prefetched.  Any
+     other read starts the window over, so a scan from there, or a
+     second pass from the start, is prefetched too. */
+  if (!sequential)
+    inode->ra_end = 0;
+  else if (bytes_read > 0)
+    inode_read_ahead(inode, length, offset);
+  inode->ra_next = offset;
+  rwlock_release_read(&inode->i_lock);
 
   return bytes_read;
 }
@@ -474,8 +786,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past the end of file grows INODE, holding its lock
+   exclusively until the new length is published; other writes
+   share it with readers. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
@@ -484,17 +797,32 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   //   printf("inode_write_at(): tid(%d), sector(%d), buffer_(%s), size(%d), offset(%d)\n", thread_current()->tid, inode->sector, (const char *)buffer_, size, offset);
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool grow;
 
+  grow = offset + size > inode_length(inode);
+  if (grow)
+    rwlock_acquire_write(&inode->i_lock);
+  else
+    rwlock_acquire_read(&inode->i_lock);
+
+  /* inode_deny_write() holds i_lock exclusively, so it can't slip
+     in between this check and the write. */
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      if (grow)
+        rwlock_release_write(&inode->i_lock);
+      else
+        rwlock_release_read(&inode->i_lock);
+      return 0;
+    }
 
-  if(offset + size > inode_length(inode)){
-    if(!inode->isdir)
-      lock_acquire(&inode->i_lock);
+  /* Another writer may have grown it while we waited. */
+  if(grow && offset + size > inode_length(inode)){
+    lock_acquire(&inode->index_lock);
     inode->length = grow_inode(inode, offset + size);
-    if(!inode->isdir)
-      lock_release(&inode->i_lock);
+    /* Growth rewrote the partially filled index blocks. */
+    inode_drop_index(inode);
+    lock_release(&inode->index_lock);
   }
 
   while (size > 0) 
@@ -514,40 +842,21 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          // block_write (fs_device, sector_idx, buffer + bytes_written);
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /*If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left){
-            block_read(fs_device, sector_idx, bounce);
-          }
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write(fs_device, sector_idx, bounce);
-        }
+      /* Copy the chunk into the buffer cache; a partial sector is
+         read in first so the bytes around the chunk survive. */
+      write_cache_at(fs_device, sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
-  inode->read_length = inode_length(inode);
+  if (grow)
+    {
+      inode->read_length = inode_length(inode);
+      rwlock_release_write(&inode->i_lock);
+    }
+  else
+    rwlock_release_read(&inode->i_lock);
   // printf("inode_write_at(): tid(%d), inode_sector(%d), read_length(%d)\n", thread_current()->tid, inode->sector, inode->read_length);
   // printf("inode_write_at(): inode_sector(%d), read_length(%d)\n", inode->sector, inode->read_length);
   return bytes_written;
@@ -726,6 +1035,17 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 //   }
 // }
 
+/* Length a file grown to LENGTH actually reaches when the last
+   N_SECTORS of its sectors could not be allocated: the end of the
+   last sector it did get, so the caller sees a short write. */
+static off_t
+grown_length (off_t length, size_t n_sectors)
+{
+  if (n_sectors == 0)
+    return length;
+  return (bytes_to_sectors(length) - n_sectors) * BLOCK_SECTOR_SIZE;
+}
+
 off_t grow_inode(struct inode *inode, off_t length){
   static char zeros[BLOCK_SECTOR_SIZE];
   size_t n_sectors = bytes_to_sectors(length) - bytes_to_sectors(inode->length);
@@ -733,9 +1053,26 @@ off_t grow_inode(struct inode *inode, off_t length){
   if (n_sectors == 0)
     return length;
 
+  if (inode->format == INODE_EXTENTS){
+    // chain another overflow sector whenever the run table fills up
+    while ((n_sectors = extent_grow(inode->extents, &inode->extent_cnt,
+                                    extent_cap(inode), n_sectors)) > 0
+           && inode->extent_cnt == extent_cap(inode)){
+      block_sector_t sector;
+      if (!free_map_allocate(1, &sector))
+        break;
+      if (!extent_add_block(inode, sector)){
+        free_map_release(sector, 1);
+        break;
+      }
+    }
+    extent_index(inode);
+    return grown_length(length, n_sectors);
+  }
+
   while(inode->direct_index < DIRECT_BLOCKS){
     free_map_allocate(1, &inode->blocks[inode->direct_index]);
-    block_write(fs_device, inode->blocks[inode->direct_index], zeros);
+    write_cache(fs_device, inode->blocks[inode->direct_index], zeros);
     inode->direct_index ++;
     n_sectors --;
     if(n_sectors == 0)
@@ -749,7 +1086,7 @@ off_t grow_inode(struct inode *inode, off_t length){
   if (inode->direct_index == DIRECT_BLOCKS + 1){
     n_sectors = add_dindirect_block(inode, n_sectors);
   }
-  return length - n_sectors*BLOCK_SECTOR_SIZE;
+  return grown_length(length, n_sectors);
 }
 
 size_t add_indirect_block(struct inode *inode, size_t n_sectors){
@@ -758,19 +1095,19 @@ size_t add_indirect_block(struct inode *inode, size_t n_sectors){
   if (inode->indirect_index == 0)
     free_map_allocate(1, &inode->blocks[inode->direct_index]);
   else{
-    block_read(fs_device, inode->blocks[inode->direct_index], &i_block);
+    read_cache(fs_device, inode->blocks[inode->direct_index], &i_block);
   }
   
   while (inode->indirect_index < INDIRECT_BLOCKS){
     free_map_allocate(1, &i_block.blocks[inode->indirect_index]);
-    block_write(fs_device, i_block.blocks[inode->indirect_index], zeros);
+    write_cache(fs_device, i_block.blocks[inode->indirect_index], zeros);
     inode->indirect_index ++;
     n_sectors --;
     if (n_sectors == 0)
       break;
   }
 
-  block_write(fs_device, inode->blocks[inode->direct_index], &i_block);
+  write_cache(fs_device, inode->blocks[inode->direct_index], &i_block);
   if (inode->indirect_index == INDIRECT_BLOCKS){
     inode->indirect_index = 0;
     inode->direct_index ++;
@@ -784,7 +1121,7 @@ size_t add_dindirect_block(struct inode *inode, size_t n_sectors){
   if (inode->d_indirect_index == 0 && inode->indirect_index == 0)
     free_map_allocate(1, &inode->blocks[inode->direct_index]);
   else{
-    block_read(fs_device, inode->blocks[inode->direct_index], &i_block);
+    read_cache(fs_device, inode->blocks[inode->direct_index], &i_block);
   }
 
   while (inode->indirect_index < INDIRECT_BLOCKS){
@@ -794,7 +1131,7 @@ size_t add_dindirect_block(struct inode *inode, size_t n_sectors){
       break;
   }
 
-  block_write(fs_device, inode->blocks[inode->direct_index], &i_block);
+  write_cache(fs_device, inode->blocks[inode->direct_index], &i_block);
   return n_sectors;
 }
 
@@ -804,19 +1141,19 @@ size_t add_ddindirect_block(struct inode *inode, size_t n_sectors, struct indire
   if(inode->d_indirect_index == 0)
     free_map_allocate(1, &i_block->blocks[inode->indirect_index]);
   else{
-    block_read(fs_device, i_block->blocks[inode->indirect_index], &d_block);
+    read_cache(fs_device, i_block->blocks[inode->indirect_index], &d_block);
   }
 
   while(inode->d_indirect_index < INDIRECT_BLOCKS){
     free_map_allocate(1, &d_block.blocks[inode->d_indirect_index]);
-    block_write(fs_device, d_block.blocks[inode->d_indirect_index], zeros);
+    write_cache(fs_device, d_block.blocks[inode->d_indirect_index], zeros);
     inode->d_indirect_index ++;
     n_sectors--;
     if (n_sectors == 0)
       break;
   }
 
-  block_write(fs_device, i_block->blocks[inode->indirect_index], &d_block);
+  write_cache(fs_device, i_block->blocks[inode->indirect_index], &d_block);
   if(inode->d_indirect_index == INDIRECT_BLOCKS){
     inode->d_indirect_index = 0;
     inode->indirect_index ++;
@@ -825,13 +1162,155 @@ size_t add_ddindirect_block(struct inode *inode, size_t n_sectors, struct indire
   return n_sectors;
 }
 
-/* Disables writes to INODE.
+/* Appends N_SECTORS zeroed sectors to the file whose runs are
+   the first *EXTENT_CNT entries of EXTENTS, which has room for
+   MAX runs.  The last run is extended in place while the sectors
+   after it are free; otherwise a new run is started, halving the
+   request until the free map has room for it.  Returns the number
+   of sectors that could not be allocated because the disk or the
+   extent table is full. */
+static size_t
+extent_grow (struct extent *extents, uint32_t *extent_cnt, uint32_t max,
+             size_t n_sectors)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  while (n_sectors > 0)
+    {
+      struct extent *last = *extent_cnt > 0 ? &extents[*extent_cnt - 1] : NULL;
+      block_sector_t start = 0;
+      size_t cnt = 0;
+      size_t i;
+
+      if (last != NULL)
+        {
+          start = last->start + last->length;
+          cnt = free_map_extend (start, n_sectors);
+          last->length += cnt;
+        }
+      if (cnt == 0)
+        {
+          if (*extent_cnt == max)
+            break;
+          for (cnt = n_sectors; cnt > 0; cnt /= 2)
+            if (free_map_allocate (cnt, &start))
+              break;
+          if (cnt == 0)
+            break;
+          extents[*extent_cnt].start = start;
+          extents[*extent_cnt].length = cnt;
+          (*extent_cnt)++;
+        }
+      for (i = 0; i < cnt; i++)
+        write_cache(fs_device, start + i, zeros);
+      n_sectors -= cnt;
+    }
+  return n_sectors;
+}
+
+/* Returns the first EXTENT_CNT runs in EXTENTS to the free map. */
+static void
+extent_release (struct extent *extents, uint32_t extent_cnt)
+{
+  uint32_t i;
+
+  for (i = 0; i < extent_cnt; i++)
+    free_map_release (extents[i].start, extents[i].length);
+}
+
+/* Recomputes the first file sector of each of INODE's runs, used
+   by extent_to_sector() to search them. */
+static void
+extent_index (struct inode *inode)
+{
+  uint32_t first = 0;
+  uint32_t i;
+
+  for (i = 0; i < inode->extent_cnt; i++)
+    {
+      inode->ext_first[i] = first;
+      first += inode->extents[i].length;
+    }
+}
+
+/* Returns the number of runs INODE's extent table has room for. */
+static uint32_t
+extent_cap (const struct inode *inode)
+{
+  return EXTENT_CNT + inode->ext_block_cnt * EXT_BLOCK_CNT;
+}
+
+/* Appends overflow extent SECTOR to INODE's chain, making room for
+   EXT_BLOCK_CNT more runs.  Returns false if out of memory, leaving
+   the chain as it was. */
+static bool
+extent_add_block (struct inode *inode, block_sector_t sector)
+{
+  uint32_t cap = extent_cap(inode) + EXT_BLOCK_CNT;
+  block_sector_t *blocks;
+  struct extent *extents;
+  uint32_t *first;
+
+  blocks = realloc(inode->ext_blocks,
+                   (inode->ext_block_cnt + 1) * sizeof *blocks);
+  if (blocks == NULL)
+    return false;
+  inode->ext_blocks = blocks;
+  extents = realloc(inode->extents, cap * sizeof *extents);
+  if (extents == NULL)
+    return false;
+  inode->extents = extents;
+  first = realloc(inode->ext_first, cap * sizeof *first);
+  if (first == NULL)
+    return false;
+  inode->ext_first = first;
+  inode->ext_blocks[inode->ext_block_cnt++] = sector;
+  return true;
+}
+
+/* Reads the overflow extent chain starting at NEXT into INODE.
+   Returns false if out of memory. */
+static bool
+extent_load (struct inode *inode, block_sector_t next)
+{
+  while (next != 0){
+    if (!extent_add_block(inode, next))
+      return false;
+    read_cache_at(fs_device, next,
+                  inode->extents + extent_cap(inode) - EXT_BLOCK_CNT,
+                  offsetof(struct extent_block, extents),
+                  sizeof ((struct extent_block *) 0)->extents);
+    read_cache_at(fs_device, next, &next, 0, sizeof next);
+  }
+  return true;
+}
+
+/* Writes INODE's overflow extent chain back to its sectors. */
+static void
+extent_store (struct inode *inode)
+{
+  uint32_t i;
+
+  for (i = 0; i < inode->ext_block_cnt; i++){
+    block_sector_t sector = inode->ext_blocks[i];
+    block_sector_t next = i + 1 < inode->ext_block_cnt ? inode->ext_blocks[i + 1] : 0;
+    write_cache_at(fs_device, sector, &next, 0, sizeof next);
+    write_cache_at(fs_device, sector,
+                   inode->extents + EXTENT_CNT + i * EXT_BLOCK_CNT,
+                   offsetof(struct extent_block, extents),
+                   sizeof ((struct extent_block *) 0)->extents);
+  }
+}
+
+/* Disables writes to INODE, once writes already under way are done.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write(&inode->i_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write(&inode->i_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -840,9 +1319,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write(&inode->i_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write(&inode->i_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -7,8 +7,14 @@
 
 struct bitmap;
 
+/* True if new inodes use extents rather than the block map.
+   Set by the -extents option at format time; taken from the disk
+   otherwise. */
+extern bool inode_extents;
+
 // bool check_alloc (struct inode_disk *disk_inode);
 void inode_init (void);
+void inode_load_format (block_sector_t);
 bool inode_create (block_sector_t, off_t, int);
 // bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
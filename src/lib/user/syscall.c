@@ -182,3 +182,27 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+int
+shm_open (const char *name, unsigned size)
+{
+  return syscall2 (SYS_SHM_OPEN, name, size);
+}
+
+bool
+shm_map (int shmid, void *addr)
+{
+  return syscall2 (SYS_SHM_MAP, shmid, addr);
+}
+
+void
+shm_unmap (int shmid)
+{
+  syscall1 (SYS_SHM_UNMAP, shmid);
+}
@@ -45,4 +45,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+int shm_open (const char *name, unsigned size);
+bool shm_map (int shmid, void *addr);
+void shm_unmap (int shmid);
+
 #endif /* lib/user/syscall.h */
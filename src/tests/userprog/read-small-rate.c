@@ -0,0 +1,29 @@
+/* Reads "sample.txt" one byte at a time, over and over, so that
+   the run time is dominated by the cost of a small read() system
+   call.  The check script fails the run if it took so many timer
+   ticks that read() must be sleeping. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define READ_CNT 5000
+
+void
+test_main (void) 
+{
+  int handle;
+  char c;
+  int i;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  msg ("begin %d one-byte reads", READ_CNT);
+  for (i = 0; i < READ_CNT; i++)
+    if (read (handle, &c, 1) != 1)
+      {
+        seek (handle, 0);
+        if (read (handle, &c, 1) != 1)
+          fail ("read %d failed", i);
+      }
+  msg ("end %d one-byte reads", READ_CNT);
+}
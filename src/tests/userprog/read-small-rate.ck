@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(read-small-rate) begin
+(read-small-rate) open "sample.txt"
+(read-small-rate) begin 5000 one-byte reads
+(read-small-rate) end 5000 one-byte reads
+(read-small-rate) end
+read-small-rate: exit(0)
+EOF
+
+# User programs can't read the timer, so the run's ticks, boot
+# included, are all there is to go by, and they vary with the
+# simulator.  Only a read that sleeps is caught: at 10 ticks per
+# read that costs 50000 ticks, far over the 2 per read allowed.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($ticks) = map (/Timer: (\d+) ticks/, @output);
+fail "no \"Timer: N ticks\" line in output\n" if !defined $ticks;
+fail "$ticks ticks for 5000 one-byte reads\n" if $ticks > 2 * 5000;
+pass;
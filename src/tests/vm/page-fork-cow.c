@@ -0,0 +1,48 @@
+/* Fills 2 MB of memory, forks, and has the child check and then
+   rewrite all of it while the parent waits.  The two processes
+   share the pages copy-on-write until the child writes them, so
+   shared frames have to be evicted to make room for its copies.
+   Each process must still see its own contents. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+static void
+check (char value)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail ("byte %zu != %#x", i, value & 0xff);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  child = fork ();
+  if (child == 0)
+    {
+      check (0x5a);
+      memset (buf, 0xa5, sizeof buf);
+      check (0xa5);
+      exit (42);
+    }
+  if (child < 0)
+    fail ("fork failed");
+  CHECK (wait (child) == 42, "wait for child");
+
+  msg ("parent read pass");
+  check (0x5a);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-fork-cow) begin
+(page-fork-cow) initialize
+page-fork-cow: exit(42)
+(page-fork-cow) wait for child
+(page-fork-cow) parent read pass
+(page-fork-cow) end
+page-fork-cow: exit(0)
+EOF
+pass;
@@ -0,0 +1,54 @@
+/* Maps a shared memory segment in a parent and a forked child,
+   which each see the other's writes.  Once both have detached, the
+   segment's contents are gone, and reading where it was mapped
+   kills the process. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ADDR ((char *) 0x10000000)
+#define PAGE_SIZE 4096
+
+static void
+child_main (void)
+{
+  int id = shm_open ("shm-share", PAGE_SIZE);
+
+  if (id < 0 || !shm_map (id, ADDR))
+    fail ("child can't map segment");
+  if (strcmp (ADDR, "parent"))
+    fail ("child sees \"%s\"", ADDR);
+  strlcpy (ADDR + 100, "child", 6);
+  shm_unmap (id);
+  exit (81);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  int id;
+
+  CHECK ((id = shm_open ("shm-share", PAGE_SIZE)) >= 0, "open segment");
+  CHECK (shm_map (id, ADDR), "map segment");
+  strlcpy (ADDR, "parent", 7);
+
+  child = fork ();
+  if (child == 0)
+    child_main ();
+  if (child < 0)
+    fail ("fork failed");
+  CHECK (wait (child) == 81, "wait for child");
+  CHECK (!strcmp (ADDR + 100, "child"), "parent sees child's write");
+
+  shm_unmap (id);
+  CHECK (shm_map (id, ADDR), "map segment again");
+  CHECK (ADDR[0] == '\0', "last detach freed the segment");
+
+  shm_unmap (id);
+  msg ("read after detach");
+  msg ("byte 0 is %d", *(volatile char *) ADDR);
+  fail ("should have exited with -1");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-share) begin
+(shm-share) open segment
+(shm-share) map segment
+shm-share: exit(81)
+(shm-share) wait for child
+(shm-share) parent sees child's write
+(shm-share) map segment again
+(shm-share) last detach freed the segment
+(shm-share) read after detach
+shm-share: exit(-1)
+EOF
+pass;
@@ -0,0 +1,40 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 signed fixed-point numbers, for the MLFQS scheduler's
+   recent_cpu and load_avg.  Integers are N, fixed-point numbers
+   X and Y. */
+typedef int fixed_t;
+
+#define FP_SHIFT 14
+#define FP_ONE (1 << FP_SHIFT)
+
+static inline fixed_t fp_int (int n) { return n * FP_ONE; }
+
+/* Rounds X toward zero. */
+static inline int fp_trunc (fixed_t x) { return x / FP_ONE; }
+
+/* Rounds X to the nearest integer. */
+static inline int
+fp_round (fixed_t x)
+{
+  return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+static inline fixed_t fp_add_int (fixed_t x, int n) { return x + n * FP_ONE; }
+
+static inline fixed_t
+fp_mul (fixed_t x, fixed_t y)
+{
+  return ((int64_t) x) * y / FP_ONE;
+}
+
+static inline fixed_t
+fp_div (fixed_t x, fixed_t y)
+{
+  return ((int64_t) x) * FP_ONE / y;
+}
+
+#endif /* threads/fixed-point.h */
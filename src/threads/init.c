@@ -38,9 +38,11 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #include "filesys/cache.h"
 #endif
 #ifdef VM
+#include "vm/shm.h"
 #include "vm/swap.h"
 #endif
 
@@ -121,6 +123,7 @@ main (void)
   syscall_init ();
 
   frame_init();
+  zero_page_init();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
@@ -140,6 +143,7 @@ main (void)
 
 #ifdef VM
   swap_init();
+  shm_init();
 #endif
 
   printf ("Boot complete.\n");
@@ -258,6 +262,8 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-extents"))
+        inode_extents = true;
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
@@ -386,6 +392,7 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -extents           Use extent-based inodes when formatting.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
@@ -232,7 +232,7 @@ void chain_donation(struct list *list, struct thread *holder, struct thread *cur
             }
           }
         }
-        temp_pair->donatee->priority = cur->priority;
+        thread_update_priority(temp_pair->donatee, cur->priority);
         chain_donation(list, temp_pair->donatee, cur, lock);
       }
     }
@@ -256,7 +256,8 @@ lock_acquire (struct lock *lock)
 
   struct thread *cur = thread_current();
 
-  if (lock->holder && lock->holder->priority < cur->priority) {
+  /* No donation under the MLFQS scheduler */
+  if (!thread_mlfqs && lock->holder && lock->holder->priority < cur->priority) {
 
     struct priority donated_priority;
     /* struct list *target_list = &lock->holder->donation_list; */
@@ -265,7 +266,7 @@ lock_acquire (struct lock *lock)
       lock->holder->origin_priority = lock->holder->priority;
 
     /* donation */
-    lock->holder->priority = cur->priority;
+    thread_update_priority(lock->holder, cur->priority);
 
     /* add to donation list */
     struct donate_pair new_donate_pair;
@@ -456,3 +457,70 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes readers-writer lock RW. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->writer_ok);
+  rw->readers = 0;
+  rw->waiting_writers = 0;
+  rw->writer = false;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  A thread must not acquire RW for reading
+   twice, since a writer queued in between would deadlock it. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  while (rw->writer || rw->waiting_writers > 0)
+    cond_wait (&rw->readers_ok, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/* Releases a read hold on RW. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or writer
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer || rw->readers > 0)
+    cond_wait (&rw->writer_ok, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = true;
+  lock_release (&rw->lock);
+}
+
+/* Releases a write hold on RW, handing it to the next writer if
+   one is waiting and to all waiting readers otherwise. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer);
+  rw->writer = false;
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  else
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
@@ -61,6 +61,25 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   Any number of readers or a single writer may hold it at once.
+   Waiting writers block new readers so they are not starved. */
+struct rwlock
+  {
+    struct lock lock;           /* Guards the fields below. */
+    struct condition readers_ok;/* Signaled when readers may enter. */
+    struct condition writer_ok; /* Signaled when a writer may enter. */
+    int readers;                /* Number of readers holding it. */
+    int waiting_writers;        /* Number of writers waiting. */
+    bool writer;                /* True if a writer holds it. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
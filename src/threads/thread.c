@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/syscall.h"
@@ -26,9 +27,14 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running: one FIFO queue per
+   priority.  Bit PRI_MAX - P of ready_mask is set while queue P is
+   not empty, so the highest priority queue in use is found with a
+   find-first-set. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint32_t ready_mask[(PRI_MAX + 32) / 32];
+static int ready_cnt;           /* Threads in all the queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -67,6 +73,15 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* MLFQS: estimated number of threads ready to run over the past
+   minute. */
+static fixed_t load_avg;
+
+/* MLFQS: set when every thread's recent_cpu has been decayed, so
+   every thread's priority must be recomputed, not just that of the
+   running thread, whose recent_cpu alone changes between seconds. */
+static bool priorities_stale;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -78,13 +93,63 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
-static bool compare(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+static void ready_push (struct thread *t);
+static void ready_remove (struct thread *t);
+static struct thread *ready_pop (void);
+static int ready_max_priority (void);
+static int mlfqs_priority (struct thread *t);
+static void mlfqs_tick (struct thread *cur);
+static void mlfqs_decay (struct thread *t, void *aux UNUSED);
+static void mlfqs_update (struct thread *t, void *aux UNUSED);
+
+/* Adds ready thread T to the back of its priority's queue.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  int bit = PRI_MAX - t->priority;
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask[bit / 32] |= 1u << (bit % 32);
+  ready_cnt++;
+}
 
-/* Project #1 */
-static bool compare(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-  struct thread *t_a = list_entry(a, struct thread, elem);
-  struct thread *t_b = list_entry(b, struct thread, elem);
-  return t_a->priority > t_b->priority;
+/* Removes ready thread T from its priority's queue.  Interrupts
+   must be off. */
+static void
+ready_remove (struct thread *t)
+{
+  int bit = PRI_MAX - t->priority;
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask[bit / 32] &= ~(1u << (bit % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority of a ready thread, or -1 if there
+   are none.  Interrupts must be off. */
+static int
+ready_max_priority (void)
+{
+  size_t i;
+  for (i = 0; i < sizeof ready_mask / sizeof *ready_mask; i++)
+    if (ready_mask[i] != 0)
+      return PRI_MAX - (int) (i * 32 + __builtin_ffs (ready_mask[i]) - 1);
+  return -1;
+}
+
+/* Removes and returns the first thread of the highest priority
+   queue in use, or returns NULL if there are none.  Interrupts
+   must be off. */
+static struct thread *
+ready_pop (void)
+{
+  int priority = ready_max_priority ();
+  struct thread *t;
+  if (priority < 0)
+    return NULL;
+  t = list_entry (list_front (&ready_queues[priority]), struct thread, elem);
+  ready_remove (t);
+  return t;
 }
 
 /* Initializes the threading system by transforming the code
@@ -103,10 +168,13 @@ static bool compare(const struct list_elem *a, const struct list_elem *b, void *
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -150,11 +218,80 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Updates the MLFQS statistics for a timer tick while CUR runs:
+   CUR's recent_cpu every tick, load_avg and everyone's recent_cpu
+   every second, and priorities every fourth tick.  Between seconds
+   only the threads that ran have a changed recent_cpu: CUR, and
+   those switched out since, which schedule() has updated. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t now = timer_ticks ();
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fp_add_int (cur->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0)
+    {
+      int ready = ready_cnt + (cur != idle_thread);
+      load_avg = (59 * load_avg + fp_int (ready)) / 60;
+      thread_foreach (mlfqs_decay, NULL);
+      priorities_stale = true;
+    }
+
+  if (now % 4 == 0)
+    {
+      if (priorities_stale)
+        {
+          thread_foreach (mlfqs_update, NULL);
+          priorities_stale = false;
+        }
+      else
+        mlfqs_update (cur, NULL);
+      if (ready_max_priority () > cur->priority)
+        intr_yield_on_return ();
+    }
+}
+
+/* Decays T's recent_cpu by the current load average. */
+static void
+mlfqs_decay (struct thread *t, void *aux UNUSED)
+{
+  fixed_t twice_load = 2 * load_avg;
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fp_add_int (fp_mul (fp_div (twice_load, fp_add_int (twice_load, 1)),
+                                      t->recent_cpu), t->nice);
+}
+
+/* Recomputes T's priority from its recent_cpu and nice value. */
+static void
+mlfqs_update (struct thread *t, void *aux UNUSED)
+{
+  if (t != idle_thread)
+    thread_update_priority (t, mlfqs_priority (t));
+}
+
+/* Returns the MLFQS priority of T. */
+static int
+mlfqs_priority (struct thread *t)
+{
+  int priority = fp_trunc (fp_int (PRI_MAX) - t->recent_cpu / 4 - fp_int (t->nice * 2));
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -201,6 +338,12 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
+  /* A new thread inherits its creator's MLFQS state. */
+  t->nice = thread_current ()->nice;
+  t->recent_cpu = thread_current ()->recent_cpu;
+  if (thread_mlfqs)
+    t->priority = mlfqs_priority (t);
+
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
      member cannot be observed. */
@@ -306,9 +449,7 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  /* list_push_back (&ready_list, &t->elem); */
-  /* Project #1 */
-  list_insert_ordered(&ready_list, &t->elem, &compare, NULL);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -379,9 +520,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-     // list_push_back (&ready_list, &cur->elem); 
-    /* Project #1 */
-    list_insert_ordered(&ready_list, &cur->elem, &compare, NULL);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -411,6 +550,10 @@ thread_set_priority (int new_priority)
   struct thread *cur = thread_current();
   int old_priority = cur->priority;
 
+  /* The MLFQS scheduler sets priorities itself. */
+  if (thread_mlfqs)
+    return;
+
   //thread_current ()->priority = new_priority;
 
   /* For Proj.#1 */
@@ -421,9 +564,24 @@ thread_set_priority (int new_priority)
   if(cur->priority < old_priority){
     thread_yield();
   }
-  else{
-    list_sort(&ready_list, &compare, NULL);
-  }
+}
+
+/* Changes the priority of thread T, which may be ready, blocked
+   or running, to PRIORITY, as priority donation does.  A ready
+   thread moves to the back of its new priority's queue. */
+void
+thread_update_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's priority. */
@@ -433,35 +591,56 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and, under the
+   MLFQS scheduler, recomputes its priority, yielding if it no
+   longer has the highest. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    {
+      cur->priority = mlfqs_priority (cur);
+      if (ready_max_priority () > cur->priority)
+        thread_yield ();
+    }
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -559,8 +738,8 @@ init_thread (struct thread *t, const char *name, int priority)
   lock_init(&t->file_list_lock);
 
 #ifdef VM
-  page_init(&t->sup_page_table);
   list_init(&t->mmap_table);
+  list_init(&t->shm_table);
 #endif
 #ifdef FILESYS
   t->dir = NULL;
@@ -593,16 +772,11 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  /* list_less_func *less = &compare; */
-  if (list_empty (&ready_list))
+  struct thread *t = ready_pop ();
+  if (t == NULL)
     return idle_thread;
-  else{
-    /* For proj.#2 */
-    struct thread *t = list_entry (list_pop_front (&ready_list), struct thread, elem);
-    ASSERT(t->status == THREAD_READY);
-    return t;
-    /* return list_entry (list_pop_front (&ready_list), struct thread, elem); */
-  }
+  ASSERT(t->status == THREAD_READY);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -662,11 +836,17 @@ static void
 schedule (void) 
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct thread *next;
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+
+  /* CUR's recent_cpu may have grown since its MLFQS priority was
+     last computed. */
+  if (thread_mlfqs && cur != idle_thread && cur->status != THREAD_DYING)
+    mlfqs_update (cur, NULL);
+  next = next_thread_to_run ();
   ASSERT (is_thread (next));
 
   if (cur != next)
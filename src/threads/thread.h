@@ -2,8 +2,10 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 
 /* States in a thread's life cycle. */
@@ -25,6 +27,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -89,6 +96,10 @@ struct thread
     struct list donation_list;
     struct thread *temp;
 
+    /* For the MLFQS scheduler */
+    int nice;                           /* Niceness, -20 to 20. */
+    fixed_t recent_cpu;                 /* Decayed CPU time used. */
+
 #ifdef USERPROG
     /* To implement for Proj.#2, To store the File_descriptor */
     char file_name[16];
@@ -97,8 +108,9 @@ struct thread
     struct file *execute_f;
 #endif
 #ifdef VM
-    struct list sup_page_table;
+    struct hash sup_page_table;         /* page_entry by vaddr; set up by load(). */
     struct list mmap_table;
+    struct list shm_table;              /* shm_handles, in vm/shm.c. */
     uint8_t *temp_stack;
 #endif
 #ifdef FILESYS
@@ -165,6 +177,7 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *, int);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -8,7 +8,9 @@
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
 #include "threads/palloc.h"
+#include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/shm.h"
 #include "threads/malloc.h"
 
 /* Number of page faults processed. */
@@ -155,6 +157,10 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* A write to a page shared after fork() gets its own copy. */
+  if (!not_present && write && is_user_vaddr(fault_addr) && copy_on_write(fault_addr))
+    return;
+
   /* For error handling */
   if (!not_present || fault_addr == NULL || !is_user_vaddr(fault_addr)){
     syscall_exit(-1);
@@ -168,6 +174,16 @@ page_fault (struct intr_frame *f)
   struct page_entry *new_entry = lookup_page(fault_addr);
 
   if(new_entry != NULL){
+    /* Another thread may be evicting the page right now */
+    frame_wait(new_entry);
+    /* For shared memory segments(in vm/shm.c) */
+    if(new_entry->location == SHM){
+      if(!shm_fault(new_entry)){
+        syscall_exit(-1);
+        return;
+      }
+      return;
+    }
     /* For reclamation(frame is in the DISK) */
     if(new_entry->location == DISK){
       if(!reclamation(fault_addr, user, new_entry->writable)){
@@ -178,10 +194,19 @@ page_fault (struct intr_frame *f)
     }
     /* For controlling the lazy_loading(in process.c) */
     if(new_entry->lazy_loading){
+      /* Reading an all-zero page maps the shared zero page */
+      if(!write && new_entry->page_zero_bytes == PGSIZE){
+        if(!zero_page_map(fault_addr, new_entry->writable)){
+          syscall_exit(-1);
+          return;
+        }
+        return;
+      }
       if(!lazy_load_segment(fault_addr, user, new_entry->writable, new_entry->file, new_entry->offset, new_entry->page_zero_bytes)){
         syscall_exit(-1);
         return;
       }
+      fault_around(fault_addr);
       return;
     }
     /* For controlling the mmap(in syscall.c) */
@@ -194,6 +219,14 @@ page_fault (struct intr_frame *f)
     }
   /* For controlling the stack_growing */
   } else if (new_entry == NULL && fault_addr >= (stack_ptr - 32) && (PHYS_BASE - pg_round_down (fault_addr)) <= (8 * (1 << 20))){ 
+    /* A stack page that is only read so far is the zero page */
+    if(!write){
+      if(!zero_page_map(fault_addr, true)){
+        syscall_exit(-1);
+        return;
+      }
+      return;
+    }
     if(!stack_growth(fault_addr, true, write)){
       syscall_exit(-1);
       return;
@@ -23,8 +23,12 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 #include "vm/frame.h"
+#include "vm/shm.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func fork_process NO_RETURN;
+static bool fork_duplicate (struct thread *parent);
+static bool fork_files (struct thread *parent);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 /* For proj #2 */
@@ -63,6 +67,29 @@ process_execute (const char *file_name)
  return tid;
 }
 
+/* Argument to fork_process(), on the parent's stack: thread_create()
+   returns only after the child has read it. */
+struct fork_args
+  {
+    struct thread *parent;
+    struct intr_frame if_;              /* Parent's registers at fork(). */
+  };
+
+/* Creates a copy of the current process that resumes from the
+   system call with interrupt frame F, returning 0 there.  Writable
+   memory is shared copy-on-write.  Returns the new process's
+   thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct fork_args args;
+
+  args.parent = cur;
+  memcpy (&args.if_, f, sizeof args.if_);
+  return thread_create (cur->name, PRI_DEFAULT, fork_process, &args);
+}
+
 /* Find the right member in the family list */
 struct member *lookup_child(tid_t tid) {
   struct list_elem *e;
@@ -205,6 +232,111 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* A thread function that duplicates the parent's address space
+   and files and returns to user mode where the parent called
+   fork(). */
+static void
+fork_process (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_;
+  bool success;
+
+  memcpy (&if_, &args->if_, sizeof if_);
+  strlcpy (t->file_name, args->parent->file_name, sizeof t->file_name);
+
+  success = fork_duplicate (args->parent);
+  loading_result (success);
+
+  if (!success)
+    {
+      printf ("%s: exit(%d)\n", t->file_name, -1);
+      thread_exit ();
+    }
+
+  /* fork() returns 0 in the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread a copy of PARENT's page directory,
+   supplemental page table, executable and file descriptors.
+   PARENT is blocked in process_fork() meanwhile.  Only the file
+   duplication takes filesys_lock: copying the pages may have to
+   evict, and waits for other processes' swap I/O. */
+static bool
+fork_duplicate (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  bool success;
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  process_activate ();
+  if (!page_init (&t->sup_page_table))
+    return false;
+
+  if (parent->execute_f != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      t->execute_f = file_reopen (parent->execute_f);
+      if (t->execute_f != NULL)
+        file_deny_write (t->execute_f);
+      lock_release (&filesys_lock);
+      if (t->execute_f == NULL)
+        return false;
+    }
+
+  if (!page_table_fork (parent))
+    return false;
+
+  lock_acquire (&filesys_lock);
+  success = fork_files (parent);
+  lock_release (&filesys_lock);
+  return success;
+}
+
+/* Gives the current thread its own copy of each of PARENT's file
+   descriptors, and its working directory.  Must be called with
+   filesys_lock held. */
+static bool
+fork_files (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  /* Each descriptor gets its own file at the same position. */
+  for (e = list_begin (&parent->file_list); e != list_end (&parent->file_list);
+       e = list_next (e))
+    {
+      struct fd *pfd = list_entry (e, struct fd, elem);
+      struct fd *fd = malloc (sizeof *fd);
+      if (fd == NULL)
+        return false;
+      *fd = *pfd;
+      if (pfd->file_p != NULL)
+        {
+          fd->file_p = file_reopen (pfd->file_p);
+          if (fd->file_p == NULL)
+            {
+              free (fd);
+              return false;
+            }
+          file_seek (fd->file_p, file_tell (pfd->file_p));
+        }
+      list_push_back (&t->file_list, &fd->elem);
+    }
+
+#ifdef FILESYS
+  if (parent->dir != NULL)
+    t->dir = dir_reopen (parent->dir);
+#endif
+  return true;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -307,19 +439,16 @@ process_exit (void)
   while(!list_empty(mmap_table)) {
     e = list_pop_front(mmap_table);
     me = list_entry(e, struct mmap_entry, elem);
-    file_unmap(me->file);
+    file_unmap(me);
     free(me);
   }
 
-  /* Find the remain sup_page_entry, then free them all. */
-  struct list *page_table = &cur->sup_page_table;
-  struct page_entry *pe;
-  while(!list_empty(page_table)) {
-    e = list_pop_front(page_table);
-    pe = list_entry(e, struct page_entry, elem);
-    free(pe);
-    // TODO : free the entry which is in frame or swap table
-  }
+  /* Unmap and close the shared memory segments. */
+  shm_exit();
+
+  /* Stop eviction from choosing our pages, then free them all. */
+  frame_exit();
+  page_destroy(&cur->sup_page_table);
 
   /* If current thread has execute_file, we execute allow_write and file_close for read_only_child cases */
   if(cur->execute_f){
@@ -450,6 +579,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
+  /* Set up the supplemental page table. */
+  if (!page_init (&t->sup_page_table))
+    goto done;
+
   /* Open executable file. */
   file = filesys_open (file_name);
 
@@ -685,9 +818,17 @@ setup_stack (void **esp)
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
+      uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+      success = install_page (upage, kpage, true);
       if (success)
-        *esp = PHYS_BASE;
+        {
+          /* Track it like any other page, so fork() and eviction
+             see it. */
+          struct page_entry *pe = locate_page (upage, PHYS);
+          pe->writable = true;
+          insert_frame_table (kpage, pe);
+          *esp = PHYS_BASE;
+        }
       else{
         palloc_free_page (kpage);
       }
@@ -8,6 +8,7 @@
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #include "devices/shutdown.h"
+#include "devices/block.h"
 #include "userprog/process.h"
 #include "lib/string.h"
 #include "filesys/file.h"
@@ -17,14 +18,23 @@
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include <round.h>
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 #include "vm/frame.h"
+#include "vm/shm.h"
 
 static void syscall_handler (struct intr_frame *);
 static struct mmap_entry *allocate_mmap(struct file *file);
 static struct mmap_entry *lookup_mmap(mapid_t mapid);
 static bool sort(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+static int read_to_user(struct file *file, uint8_t *buffer, unsigned size);
+static int write_from_user(struct file *file, const uint8_t *buffer, unsigned size);
+
+/* File data moves between user memory and the file system through a
+   kernel buffer of at most this many bytes, so that a fault on the
+   user buffer is never taken with a buffer cache or inode lock held. */
+#define BOUNCE_SIZE PGSIZE
 
 
 /* For Proj.#2 */
@@ -117,6 +127,12 @@ syscall_handler (struct intr_frame *f UNUSED)
       break;
     }
 
+    case SYS_FORK:
+    {
+      f->eax = process_fork(f);
+      break;
+    }
+
     case SYS_WAIT:
     {
       tid_t tid = ((int *)f->esp)[1];
@@ -350,6 +366,48 @@ syscall_handler (struct intr_frame *f UNUSED)
       break;
     }
 
+    case SYS_SHM_OPEN:
+    {
+      if(!check_right_add(f->esp + 8)){
+        syscall_exit(-1);
+        break;
+      }
+
+      const char *name = (char *)(((int *)f->esp)[1]);
+      unsigned size = ((unsigned *)f->esp)[2];
+      if (!valid_file_ptr(name)) {
+        syscall_exit(-1);
+        break;
+      }
+      f->eax = shm_get(name, size);
+      break;
+    }
+
+    case SYS_SHM_MAP:
+    {
+      if(!check_right_add(f->esp + 8)){
+        syscall_exit(-1);
+        break;
+      }
+
+      int shmid = ((int *)f->esp)[1];
+      void *addr = (void *)(((int *)f->esp)[2]);
+      f->eax = shm_attach(shmid, addr);
+      break;
+    }
+
+    case SYS_SHM_UNMAP:
+    {
+      if(!check_right_add(f->esp + 4)){
+        syscall_exit(-1);
+        break;
+      }
+
+      int shmid = ((int *)f->esp)[1];
+      shm_detach(shmid);
+      break;
+    }
+
     case SYS_CHDIR:
     {
       const char *dir = (char *)(((int *)f->esp)[1]);
@@ -580,7 +638,6 @@ int syscall_open(const char *file){
 
 
 int syscall_read(int fd, void *buffer, unsigned size) {
-  timer_sleep(10);
   // printf("syscall_read(): tid(%d), fd(%d), buffer(%s), size(%d)\n", thread_current()->tid, fd, (char *)buffer, size);
   struct list_elem *e;
   struct fd *_fd = NULL;
@@ -626,9 +683,9 @@ int syscall_read(int fd, void *buffer, unsigned size) {
   if (inode_is_dir(file_get_inode(_fd->file_p)))
     return -1;
 
-  lock_acquire(&filesys_lock);
-  int bytes_read = (int)file_read(_fd->file_p, buffer, (off_t)size);
-  lock_release(&filesys_lock);
+  /* The inode locks are enough for file data; filesys_lock only
+     serializes changes to the namespace. */
+  int bytes_read = read_to_user(_fd->file_p, buffer, size);
 
   return bytes_read;
 }
@@ -662,12 +719,57 @@ int syscall_write(int fd, void *buffer, unsigned size) {
   if (inode_is_dir(file_get_inode(_fd->file_p)))
     return -1;
 
-  lock_acquire(&filesys_lock);
-  int bytes_write = (int)file_write(_fd->file_p, buffer, (off_t)size);
-  lock_release(&filesys_lock);
+  int bytes_write = write_from_user(_fd->file_p, buffer, size);
   return bytes_write;
 }
 
+/* Reads SIZE bytes from FILE into the user BUFFER, BOUNCE_SIZE at a
+   time, and returns the number read. */
+static int read_to_user(struct file *file, uint8_t *buffer, unsigned size) {
+  unsigned done = 0;
+  uint8_t *bounce;
+
+  if (size == 0)
+    return 0;
+  bounce = malloc(size < BOUNCE_SIZE ? size : BOUNCE_SIZE);
+  if (bounce == NULL)
+    return -1;
+  while (done < size) {
+    off_t chunk = size - done < BOUNCE_SIZE ? size - done : BOUNCE_SIZE;
+    off_t n = file_read(file, bounce, chunk);
+    memcpy(buffer + done, bounce, n);
+    done += n;
+    if (n < chunk)
+      break;
+  }
+  free(bounce);
+  return done;
+}
+
+/* Writes SIZE bytes from the user BUFFER to FILE, BOUNCE_SIZE at a
+   time, and returns the number written. */
+static int write_from_user(struct file *file, const uint8_t *buffer, unsigned size) {
+  unsigned done = 0;
+  uint8_t *bounce;
+
+  if (size == 0)
+    return 0;
+  bounce = malloc(size < BOUNCE_SIZE ? size : BOUNCE_SIZE);
+  if (bounce == NULL)
+    return -1;
+  while (done < size) {
+    off_t chunk = size - done < BOUNCE_SIZE ? size - done : BOUNCE_SIZE;
+    off_t n;
+    memcpy(bounce, buffer + done, chunk);
+    n = file_write(file, bounce, chunk);
+    done += n;
+    if (n < chunk)
+      break;
+  }
+  free(bounce);
+  return done;
+}
+
 mapid_t syscall_mmap(int fd, void *addr){
   struct thread *t = thread_current();
   struct list_elem *e;
@@ -710,6 +812,8 @@ mapid_t syscall_mmap(int fd, void *addr){
   if(re_file == NULL)
     return -1;
   else{
+    me->addr = addr;
+    me->page_cnt = DIV_ROUND_UP(filesize, PGSIZE);
     while(filesize > 0){
       size_t page_zero_bytes = filesize < PGSIZE ? PGSIZE-filesize : 0;    
       locate_mmap_page(addr, re_file, offset2, page_zero_bytes);
@@ -723,45 +827,66 @@ mapid_t syscall_mmap(int fd, void *addr){
 
 void syscall_munmap(mapid_t mapid) {
   struct mmap_entry *me = NULL;
-  struct file *file = NULL;
 
   /* Find the right mapped_file */
   me = lookup_mmap(mapid);
   if(!me)
     return;
 
-  file = me->file;
   list_remove(&me->elem);
-  free(me);
 
   /* For file_unmap handling */
-  file_unmap(file);
+  file_unmap(me);
+  free(me);
 }
 
-void file_unmap(struct file *file) {
+/* Writes back the dirty pages of mapping ME, found by address in
+   the supplemental page table.  A page being evicted meanwhile is
+   written back by the evictor instead, so we wait for it first. */
+/* Fallback copy buffer for file_unmap() when no page is free,
+   guarded by filesys_lock. */
+static char unmap_chunk[BLOCK_SECTOR_SIZE];
+
+void file_unmap(struct mmap_entry *me) {
   struct thread *t = thread_current();
-  struct list *page_table = &t->sup_page_table;
-  struct list_elem *e;
   struct page_entry *pe;
   size_t page_read_bytes;
   bool is_dirty;
+  void *bounce;
+  size_t bounce_size;
+  size_t i, ofs, chunk;
+
+  /* Without a copy page, write the page a sector at a time. */
+  bounce = palloc_get_page(0);
   lock_acquire(&filesys_lock);
-  file_seek(file, 0);
+  bounce_size = PGSIZE;
+  if (bounce == NULL) {
+    bounce = unmap_chunk;
+    bounce_size = sizeof unmap_chunk;
+  }
 
-  for (e = list_begin(page_table); e != list_end(page_table); e = list_next(e)) {
-    pe = list_entry(e, struct page_entry, elem);
-    if (pe->file == file) {
-      is_dirty = pagedir_is_dirty(t->pagedir, pe->vaddr);
+  for (i = 0; i < me->page_cnt; i++) {
+    pe = lookup_page(me->addr + i * PGSIZE);
+    if (pe != NULL && pe->file == me->file) {
+      frame_wait(pe);
+      is_dirty = pe->location == PHYS && pagedir_is_dirty(t->pagedir, pe->vaddr);
       if (is_dirty) {
-        /* If we changed the file(check the dirty bit), we write them in that file */
+        /* If we changed the file(check the dirty bit), we write them in that file,
+           from a kernel copy as the page may be evicted again under the write */
         page_read_bytes = PGSIZE - pe->page_zero_bytes;
-        file_write(file, pe->vaddr, page_read_bytes);
+        for (ofs = 0; ofs < page_read_bytes; ofs += chunk) {
+          chunk = page_read_bytes - ofs < bounce_size ? page_read_bytes - ofs : bounce_size;
+          memcpy(bounce, pe->vaddr + ofs, chunk);
+          file_write_at(me->file, bounce, chunk, pe->offset + ofs);
+        }
       }
       if (pe->location == FILE)
         /* Only free the page in sup_page_table, don't need to free the frame or page_dir */
         table_free_page(pe->vaddr);
     }
   }
+  if (bounce != unmap_chunk)
+    palloc_free_page(bounce);
   lock_release(&filesys_lock);
 }
 
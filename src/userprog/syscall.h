@@ -24,6 +24,8 @@ struct member
 struct mmap_entry {
 	mapid_t mapid;
 	struct file *file;
+	void *addr;                 /* First mapped page. */
+	size_t page_cnt;            /* Number of mapped pages. */
 	struct list_elem elem;
 };
 
@@ -39,7 +41,7 @@ int syscall_write(int fd, void *buffer, unsigned size);
 void syscall_close(int fd);
 mapid_t syscall_mmap(int fd, void *addr);
 void syscall_munmap(mapid_t mapid);
-void file_unmap(struct file *file);
+void file_unmap(struct mmap_entry *me);
 bool valid_file_ptr(const char *file);
 bool syscall_chdir(const char *dir);
 bool syscall_mkdir(const char *dir);
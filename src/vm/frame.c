@@ -1,66 +1,482 @@
 #include <stdio.h>
-#include <list.h>
+#include <debug.h>
+#include <string.h>
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 
-struct list frame_table;
+/* One entry for each page of the user pool, allocated once. */
+static struct frame_entry *frame_table;
+static size_t frame_cnt;
+static size_t frame_used;               /* Entries in use. */
+static uint8_t *frame_base;
 struct lock frame_table_lock;
 
+/* Clock hand: index of the next frame considered for eviction.
+   Guarded by frame_table_lock. */
+static size_t clock_hand;
+
+/* Signalled, under frame_table_lock, whenever a frame chosen by
+   pop_frame() has been evicted. */
+static struct condition evict_done;
+
+/* Frames holding read-only executable pages, keyed by the inode,
+   offset and length of their contents, so that processes running
+   the same program map the same frame.  Guarded by
+   frame_table_lock.  A shared frame lists the page_entries that
+   map it, so that eviction can unmap it from all of them. */
+static struct hash share_map;
+
+static struct frame_entry *find_frame(void *kpage);
+static void frame_fill(void *kpage, struct page_entry *pe, struct shm_page *sp);
+static void share_join(struct frame_entry *fe, struct page_entry *pe, struct thread *owner);
+static int share_leave(struct frame_entry *fe, struct page_entry *pe);
+static bool in_pool(void *kpage);
+static bool frame_accessed(struct frame_entry *fe);
+static bool frame_cheap(struct frame_entry *fe);
+static unsigned share_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool share_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
+
 void frame_init(void) {
 	lock_init(&frame_table_lock);
-	list_init(&frame_table);
+	cond_init(&evict_done);
+	frame_base = palloc_user_pool(&frame_cnt);
+	frame_table = calloc(frame_cnt, sizeof *frame_table);
+	if (frame_table == NULL && frame_cnt > 0)
+		PANIC("can't allocate frame table");
+	clock_hand = 0;
+	hash_init(&share_map, share_hash, share_less, NULL);
+}
+
+/* Returns the frame table entry for KPAGE, a user pool page. */
+static struct frame_entry *frame_slot(void *kpage) {
+	size_t idx = pg_no(kpage) - pg_no(frame_base);
+	ASSERT (pg_ofs(kpage) == 0 && idx < frame_cnt);
+	return &frame_table[idx];
 }
 
+/* Adds KPAGE, holding the current thread's page PE, to the frame
+   table.  It may be evicted from then on, so the page must already
+   be mapped, with its dirty bit set if its contents are in no file. */
 void insert_frame_table(void* kpage, struct page_entry *pe){
-	struct frame_entry *new_fe = (struct frame_entry *)calloc(1, sizeof(struct frame_entry));
-	struct thread *cur = thread_current();
-	new_fe->frame = kpage;
-	new_fe->owner = cur;
-	new_fe->pe = pe;
-	push_frame(new_fe);
+	lock_acquire(&frame_table_lock);
+	frame_fill(kpage, pe, NULL);
+	lock_release(&frame_table_lock);
+}
+
+/* Adds KPAGE, holding the shared memory page SP, to the frame
+   table.  shm_evict() unmaps it from every process. */
+void frame_shm_insert(void *kpage, struct shm_page *sp) {
+	lock_acquire(&frame_table_lock);
+	frame_fill(kpage, NULL, sp);
+	lock_release(&frame_table_lock);
 }
 
-void push_frame(struct frame_entry *fe) {
+/* Takes KPAGE, a shared memory page, out of the frame table so
+   that it can be freed.  Returns false if pop_frame() has already
+   chosen it; then shm_evict() frees it. */
+bool frame_shm_remove(void *kpage) {
+	struct frame_entry *fe = frame_slot(kpage);
+	bool success;
 	lock_acquire(&frame_table_lock);
-	list_push_back(&frame_table, &fe->elem);
+	success = fe->in_use;
+	if (success) {
+		fe->in_use = 0;
+		frame_used--;
+	}
 	lock_release(&frame_table_lock);
+	return success;
 }
 
+/* Puts KPAGE in the frame table as the current thread's private
+   page PE, or as the shared memory page SP.  Must be called with
+   frame_table_lock held. */
+static void frame_fill(void *kpage, struct page_entry *pe, struct shm_page *sp) {
+	struct frame_entry *fe = frame_slot(kpage);
+	fe->frame = kpage;
+	fe->owner = sp == NULL ? thread_current() : NULL;
+	fe->pe = pe;
+	fe->ref_cnt = 0;
+	fe->inode = NULL;
+	fe->shm = sp;
+	if (!fe->in_use)
+		frame_used++;
+	fe->in_use = 1;
+}
+
+/* Chooses a frame to evict with the clock algorithm, removes it
+   from the frame table and returns it.  Frames used since the hand
+   last passed get their accessed bit cleared and a second chance.
+   Among the rest, a clean frame, which can simply be dropped, is
+   preferred; otherwise the first unreferenced frame found is
+   taken.  The frame and its page are marked in transit: the owner
+   waits in frame_wait() or frame_exit() until the caller is done
+   and calls frame_evict_done().  A shared frame is taken from
+   every process that maps it: each of their pages is marked in
+   transit, and no process can share it from then on.  Returns
+   NULL if no frame is in the table. */
 struct frame_entry *pop_frame(void) {
+	struct frame_entry *fe, *victim = NULL, *fallback = NULL, *first = NULL;
+	size_t i;
+	lock_acquire(&frame_table_lock);
+	/* Two sweeps clear every accessed bit on the way. */
+	for (i = 0; i < 2 * frame_cnt && victim == NULL; i++) {
+		fe = &frame_table[clock_hand];
+		clock_hand = (clock_hand + 1) % frame_cnt;
+		if (!fe->in_use)
+			continue;
+		if (first == NULL)
+			first = fe;
+		if (frame_accessed(fe))
+			continue;
+		if (frame_cheap(fe))
+			victim = fe;
+		else if (fallback == NULL)
+			fallback = fe;
+	}
+	if (victim == NULL)
+		victim = fallback;
+	if (victim == NULL)
+		victim = first;
+	if (victim == NULL) {
+		lock_release(&frame_table_lock);
+		return NULL;
+	}
+	victim->in_use = 0;
+	frame_used--;
+	if (victim->ref_cnt > 0) {
+		struct list_elem *e;
+		if (victim->inode != NULL)
+			hash_delete(&share_map, &victim->share_elem);
+		for (e = list_begin(&victim->sharers); e != list_end(&victim->sharers); e = list_next(e))
+			list_entry(e, struct page_entry, share_elem)->evicting = 1;
+		victim->evicting = 1;
+	}
+	else if (victim->shm == NULL) {
+		victim->evicting = 1;
+		victim->pe->evicting = 1;
+	}
+	lock_release(&frame_table_lock);
+	return victim;
+}
+
+/* Drops the current thread's private frames from the frame table
+   without freeing them, so that eviction stops looking at its page
+   directory.  process_exit() calls this before it tears its pages
+   down; pagedir_destroy() then frees them.  Shared frames stay, and
+   are released by page_destroy(), which also waits out their
+   eviction. */
+void frame_exit(void) {
+	struct thread *cur = thread_current();
+	size_t i;
 	lock_acquire(&frame_table_lock);
-	struct frame_entry *fe = list_entry(list_pop_front(&frame_table), struct frame_entry, elem);
+	for (i = 0; i < frame_cnt; i++) {
+		struct frame_entry *fe = &frame_table[i];
+		if (fe->in_use && fe->shm == NULL && fe->ref_cnt == 0 && fe->owner == cur) {
+			fe->in_use = 0;
+			frame_used--;
+		}
+	}
+	/* Frames already chosen for eviction still use our pagedir. */
+	for (i = 0; i < frame_cnt; i++)
+		while (frame_table[i].evicting && frame_table[i].owner == cur)
+			cond_wait(&evict_done, &frame_table_lock);
 	lock_release(&frame_table_lock);
-	return fe;
 }
 
-void table_free_frame(void *kpage) {
+/* Waits until the current thread's page PE is no longer being
+   evicted, so that its location and swap slot are settled. */
+void frame_wait(struct page_entry *pe) {
 	lock_acquire(&frame_table_lock);
-	struct frame_entry *fe = lookup_frame(kpage);
-	palloc_free_page(kpage);
-	if (!fe)
-		return;
-	list_remove(&fe->elem);
-	free(fe);
+	while (pe->evicting)
+		cond_wait(&evict_done, &frame_table_lock);
 	lock_release(&frame_table_lock);
 }
 
+/* Ends the eviction of FE, chosen by pop_frame(), once its pages'
+   new locations are recorded.  The caller frees the frame after. */
+void frame_evict_done(struct frame_entry *fe) {
+	lock_acquire(&frame_table_lock);
+	ASSERT (fe->evicting);
+	fe->evicting = 0;
+	if (fe->ref_cnt > 0) {
+		struct list_elem *e;
+		for (e = list_begin(&fe->sharers); e != list_end(&fe->sharers); e = list_next(e))
+			list_entry(e, struct page_entry, share_elem)->evicting = 0;
+		fe->ref_cnt = 0;
+	}
+	else
+		fe->pe->evicting = 0;
+	cond_broadcast(&evict_done, &frame_table_lock);
+	lock_release(&frame_table_lock);
+}
+
+/* Returns the number of user pool pages not in the frame table. */
+size_t frame_free_cnt(void) {
+	return frame_cnt - frame_used;
+}
+
+/* Returns the number of user pool pages. */
+size_t frame_total_cnt(void) {
+	return frame_cnt;
+}
+
 struct frame_entry *lookup_frame(void *kpage) {
-	struct thread *t = thread_current();
-	struct list_elem *e;
-	struct frame_entry *fe = NULL;
-	struct frame_entry *found = NULL;
+	struct frame_entry *found;
 	lock_acquire(&frame_table_lock);
-	for (e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e)) {
-		fe = list_entry(e, struct frame_entry, elem);
-		if (kpage == fe->frame && t == fe->owner) {
-			found = fe;
-			break;
+	found = find_frame(kpage);
+	lock_release(&frame_table_lock);
+	return found;
+}
+
+/* Returns the current thread's frame at KPAGE, or NULL if KPAGE
+   is not one.  Must be called with frame_table_lock held. */
+static struct frame_entry *find_frame(void *kpage) {
+	struct frame_entry *fe;
+	if (!in_pool(kpage))
+		return NULL;
+	fe = frame_slot(kpage);
+	if (fe->in_use && fe->owner == thread_current())
+		return fe;
+	return NULL;
+}
+
+/* Returns whether KPAGE is a user pool page. */
+static bool in_pool(void *kpage) {
+	return (uint8_t *) kpage >= frame_base && pg_no(kpage) - pg_no(frame_base) < frame_cnt;
+}
+
+/* Returns whether FE's page was referenced since the last call,
+   clearing its accessed bit.  A shared memory page is checked in
+   shm_evict() instead.  FE's owner is alive: frame_exit() takes an
+   exiting process's frames out under frame_table_lock, which the
+   caller holds.  So are the processes sharing FE, until they
+   leave it in frame_share_put(). */
+static bool frame_accessed(struct frame_entry *fe) {
+	uint32_t *pd;
+	if (fe->shm != NULL)
+		return 0;
+	if (fe->ref_cnt > 0) {
+		struct list_elem *e;
+		bool accessed = 0;
+		for (e = list_begin(&fe->sharers); e != list_end(&fe->sharers); e = list_next(e)) {
+			struct page_entry *pe = list_entry(e, struct page_entry, share_elem);
+			pd = pe->owner->pagedir;
+			if (pagedir_is_accessed(pd, pe->vaddr)) {
+				pagedir_set_accessed(pd, pe->vaddr, 0);
+				accessed = 1;
+			}
+		}
+		return accessed;
+	}
+	pd = fe->owner->pagedir;
+	if (pd == NULL || !pagedir_is_accessed(pd, fe->pe->vaddr))
+		return 0;
+	pagedir_set_accessed(pd, fe->pe->vaddr, 0);
+	return 1;
+}
+
+/* Returns whether FE is clean, so that evicting it needs no
+   write: its page is reread from its file or zero-filled.  Shared
+   memory pages always go to swap; shared executable pages are
+   never written. */
+static bool frame_cheap(struct frame_entry *fe) {
+	uint32_t *pd;
+	if (fe->shm != NULL)
+		return 0;
+	if (fe->ref_cnt > 0)
+		return fe->inode != NULL;
+	pd = fe->owner->pagedir;
+	return pd != NULL && !pagedir_is_dirty(pd, fe->pe->vaddr);
+}
+
+/* Maps the shared frame holding the READ_BYTES bytes at OFFSET in
+   INODE, if there is one, read-only at the current thread's page
+   PE, which becomes one of its users.  Returns false if there is
+   none or it can't be mapped. */
+bool frame_share_get(struct page_entry *pe, struct inode *inode, off_t offset, size_t read_bytes) {
+	uint32_t *pd = thread_current()->pagedir;
+	struct frame_entry key, *fe;
+	struct hash_elem *e;
+	bool success = 0;
+	key.inode = inode;
+	key.offset = offset;
+	key.read_bytes = read_bytes;
+	lock_acquire(&frame_table_lock);
+	e = hash_find(&share_map, &key.share_elem);
+	if (e != NULL) {
+		fe = hash_entry(e, struct frame_entry, share_elem);
+		success = pagedir_get_page(pd, pe->vaddr) == NULL
+		          && pagedir_set_page(pd, pe->vaddr, fe->frame, 0);
+		if (success) {
+			share_join(fe, pe, thread_current());
+			pe->location = PHYS;
+			pe->lazy_loading = 0;
 		}
 	}
 	lock_release(&frame_table_lock);
-	return found;
+	return success;
+}
+
+/* Offers KPAGE, the current thread's frame for its page PE just
+   loaded with the READ_BYTES bytes at OFFSET in INODE, for
+   sharing.  It stays private if another process registered the
+   same page first or KPAGE has already been chosen for eviction. */
+void frame_share_add(void *kpage, struct page_entry *pe, struct inode *inode, off_t offset, size_t read_bytes) {
+	struct frame_entry *fe;
+	lock_acquire(&frame_table_lock);
+	fe = find_frame(kpage);
+	if (fe != NULL) {
+		ASSERT (fe->ref_cnt == 0);
+		fe->inode = inode;
+		fe->offset = offset;
+		fe->read_bytes = read_bytes;
+		if (hash_insert(&share_map, &fe->share_elem) == NULL)
+			share_join(fe, pe, thread_current());
+		else
+			fe->inode = NULL;
+	}
+	lock_release(&frame_table_lock);
+}
+
+/* For fork(): waits out any eviction of PPE, a page of PARENT, then
+   copies it to PE, the current thread's.  A resident page is
+   mapped read-only at PE as well.  A frame is then shared by both:
+   copy-on-write, if the page was writable.  A page outside the
+   user pool, such as the zero page, is mapped as it is.  Returns
+   false if the page can't be mapped. */
+bool frame_share_ref(struct thread *parent, struct page_entry *ppe, struct page_entry *pe) {
+	struct thread *cur = thread_current();
+	void *kpage;
+	bool success = 1;
+	lock_acquire(&frame_table_lock);
+	while (ppe->evicting)
+		cond_wait(&evict_done, &frame_table_lock);
+	*pe = *ppe;
+	pe->shared = 0;
+	if (pe->location == PHYS) {
+		kpage = pagedir_get_page(parent->pagedir, ppe->vaddr);
+		if (kpage == NULL || !pagedir_set_page(cur->pagedir, pe->vaddr, kpage, 0)) {
+			pe->location = FILE;
+			success = 0;
+		}
+		else if (in_pool(kpage)) {
+			struct frame_entry *fe = frame_slot(kpage);
+			bool writable = ppe->cow || pagedir_is_writable(parent->pagedir, ppe->vaddr);
+			ASSERT (fe->in_use);
+			if (writable)
+				pagedir_set_writable(parent->pagedir, ppe->vaddr, 0);
+			if (fe->ref_cnt == 0)
+				share_join(fe, ppe, parent);
+			share_join(fe, pe, cur);
+			ppe->cow = pe->cow = writable;
+		}
+	}
+	lock_release(&frame_table_lock);
+	return success;
+}
+
+/* Gives the current thread's copy-on-write page PE a writable frame
+   of its own: its shared frame itself, if no other process maps it
+   any more, or else COPY, a free user page, filled from it.
+   Returns false if COPY was not used.  If PE's frame was evicted
+   meanwhile, nothing is done and the access that faulted will
+   fault again. */
+bool frame_share_own(struct page_entry *pe, void *copy) {
+	struct thread *cur = thread_current();
+	uint32_t *pd = cur->pagedir;
+	struct frame_entry *fe;
+	void *kpage;
+	bool used = 0;
+	lock_acquire(&frame_table_lock);
+	while (pe->evicting)
+		cond_wait(&evict_done, &frame_table_lock);
+	if (!pe->shared) {
+		lock_release(&frame_table_lock);
+		return 0;
+	}
+	kpage = pagedir_get_page(pd, pe->vaddr);
+	fe = frame_slot(kpage);
+	ASSERT (fe->in_use && fe->inode == NULL);
+	if (share_leave(fe, pe) == 0) {
+		fe->owner = cur;
+		fe->pe = pe;
+	}
+	else {
+		memcpy(copy, kpage, PGSIZE);
+		/* Its page table exists, so this can't fail. */
+		pagedir_clear_page(pd, pe->vaddr);
+		pagedir_set_page(pd, pe->vaddr, copy, 1);
+		frame_fill(copy, pe, NULL);
+		used = 1;
+	}
+	/* Ready before the frame can be evicted. */
+	pagedir_set_dirty(pd, pe->vaddr, 1);
+	pagedir_set_writable(pd, pe->vaddr, 1);
+	pe->cow = 0;
+	lock_release(&frame_table_lock);
+	return used;
+}
+
+/* Waits out any eviction of the current thread's page PE, then, if
+   it still maps a shared frame, unmaps it and leaves the frame,
+   freeing it when the last user goes. */
+void frame_share_put(struct page_entry *pe) {
+	uint32_t *pd = thread_current()->pagedir;
+	lock_acquire(&frame_table_lock);
+	while (pe->evicting)
+		cond_wait(&evict_done, &frame_table_lock);
+	if (pe->shared) {
+		void *kpage = pagedir_get_page(pd, pe->vaddr);
+		struct frame_entry *fe = frame_slot(kpage);
+		ASSERT (fe->in_use);
+		pagedir_clear_page(pd, pe->vaddr);
+		if (share_leave(fe, pe) == 0) {
+			if (fe->inode != NULL)
+				hash_delete(&share_map, &fe->share_elem);
+			fe->in_use = 0;
+			frame_used--;
+			palloc_free_page(kpage);
+		}
+	}
+	lock_release(&frame_table_lock);
+}
+
+/* Adds OWNER's page PE to the processes sharing FE.  Must be
+   called with frame_table_lock held. */
+static void share_join(struct frame_entry *fe, struct page_entry *pe, struct thread *owner) {
+	if (fe->ref_cnt++ == 0)
+		list_init(&fe->sharers);
+	list_push_back(&fe->sharers, &pe->share_elem);
+	pe->owner = owner;
+	pe->shared = 1;
+}
+
+/* Removes PE from the processes sharing FE and returns how many
+   are left.  Must be called with frame_table_lock held. */
+static int share_leave(struct frame_entry *fe, struct page_entry *pe) {
+	ASSERT (fe->ref_cnt > 0);
+	list_remove(&pe->share_elem);
+	pe->shared = 0;
+	return --fe->ref_cnt;
+}
+
+static unsigned share_hash(const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame_entry *fe = hash_entry(e, struct frame_entry, share_elem);
+	return hash_bytes(&fe->inode, sizeof fe->inode) ^ hash_int(fe->offset) ^ hash_int(fe->read_bytes);
+}
+
+static bool share_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+	const struct frame_entry *fa = hash_entry(a, struct frame_entry, share_elem);
+	const struct frame_entry *fb = hash_entry(b, struct frame_entry, share_elem);
+	if (fa->inode != fb->inode)
+		return fa->inode < fb->inode;
+	if (fa->offset != fb->offset)
+		return fa->offset < fb->offset;
+	return fa->read_bytes < fb->read_bytes;
 }
@@ -1,16 +1,43 @@
+#include <hash.h>
 #include <list.h>
 #include "threads/thread.h"
+#include "filesys/off_t.h"
 
+struct inode;
+struct shm_page;
+
+/* One entry per page of the user pool, indexed by page number
+   relative to the pool's base. */
 struct frame_entry {
 	uint32_t* frame;
 	struct thread* owner;
 	struct page_entry* pe;
-	struct list_elem elem;
+	bool in_use;                /* Holds a user page. */
+	bool evicting;              /* Chosen by pop_frame(), not yet freed. */
+	// read-only executable page or copy-on-write page shared between processes
+	int ref_cnt;                /* Processes mapping it; 0 if private. */
+	struct list sharers;        /* Their page_entries, if shared. */
+	struct inode *inode;        /* Identifies its contents, with offset */
+	off_t offset;               /* and read_bytes; NULL if anonymous. */
+	size_t read_bytes;
+	struct hash_elem share_elem; /* Element in share_map. */
+	struct shm_page *shm;       /* Shared memory page it holds, if any; */
+	                            /* then it has no owner or pe. */
 };
 
 void frame_init(void);
 void insert_frame_table(void* kpage, struct page_entry *pe);
-void push_frame(struct frame_entry *fe);
+void frame_shm_insert(void *kpage, struct shm_page *sp);
+bool frame_shm_remove(void *kpage);
 struct frame_entry *pop_frame(void);
-void table_free_frame(void *kpage);
+void frame_exit(void);
+void frame_wait(struct page_entry *pe);
+void frame_evict_done(struct frame_entry *fe);
+size_t frame_free_cnt(void);
+size_t frame_total_cnt(void);
 struct frame_entry *lookup_frame(void *kpage);
+bool frame_share_get(struct page_entry *pe, struct inode *inode, off_t offset, size_t read_bytes);
+void frame_share_add(void *kpage, struct page_entry *pe, struct inode *inode, off_t offset, size_t read_bytes);
+bool frame_share_ref(struct thread *parent, struct page_entry *ppe, struct page_entry *pe);
+bool frame_share_own(struct page_entry *pe, void *copy);
+void frame_share_put(struct page_entry *pe);
@@ -1,5 +1,5 @@
 #include <stdio.h>
-#include <list.h>
+#include <hash.h>
 #include <string.h>
 #include <bitmap.h>
 #include "filesys/file.h"
@@ -15,42 +15,104 @@
 #include "userprog/process.h"
 
 static bool install_page(void *upage, void *kpage, bool writable);
+static unsigned page_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool page_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
+static void page_free(struct hash_elem *e, void *aux UNUSED);
 
-void page_init(struct list *list) {
-	list_init(list);
+/* A page of zeros mapped read-only, copy-on-write, into every
+   all-zero page that has only been read so far.  It comes from the
+   kernel pool, so it is never in the frame table or evicted. */
+static void *zero_page;
+
+/* Sets up an empty supplemental page table, keyed by page. */
+bool page_init(struct hash *page_table) {
+	return hash_init(page_table, page_hash, page_less, NULL);
+}
+
+/* Allocates the shared zero page. */
+void zero_page_init(void) {
+	zero_page = palloc_get_page(PAL_ZERO);
+	if (zero_page == NULL)
+		PANIC("can't allocate zero page");
+}
+
+/* Frees every page_entry in PAGE_TABLE, and the table itself. */
+void page_destroy(struct hash *page_table) {
+	hash_destroy(page_table, page_free);
+}
+
+static unsigned page_hash(const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_entry *pe = hash_entry(e, struct page_entry, elem);
+	return hash_int((int)pg_no(pe->vaddr));
+}
+
+static bool page_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+	const struct page_entry *pe_a = hash_entry(a, struct page_entry, elem);
+	const struct page_entry *pe_b = hash_entry(b, struct page_entry, elem);
+	return pe_a->vaddr < pe_b->vaddr;
+}
+
+static void page_free(struct hash_elem *e, void *aux UNUSED) {
+	struct page_entry *pe = hash_entry(e, struct page_entry, elem);
+	/* Other processes may still map a shared frame; this also waits
+	   out its eviction, which settles where the page is. */
+	frame_share_put(pe);
+	if (pe->location == PHYS) {
+		uint32_t *pd = thread_current()->pagedir;
+		void *kpage = pagedir_get_page(pd, pe->vaddr);
+		if (kpage == zero_page)
+			/* Keep pagedir_destroy() from freeing it. */
+			pagedir_clear_page(pd, pe->vaddr);
+		/* Otherwise frame_exit() has dropped it from the frame table,
+		   and pagedir_destroy() frees the page itself. */
+	}
+	else if (pe->location == DISK)
+		swap_free(pe->swap_index);
+	/* shm_exit() has already removed any SHM pages. */
+	free(pe);
+}
+
+/* Returns a zeroed page from the user pool, which the frame table
+   indexes, evicting one if the pool is empty.  Returns NULL if
+   none can be had, and the faulting process should then fail. */
+void *get_frame(void) {
+  void *kpage = palloc_get_page(PAL_USER | PAL_ZERO);
+  if (kpage == NULL)
+    kpage = swap_out(PAL_USER | PAL_ZERO);
+  return kpage;
 }
 
 /* If this vaddr's page is in the DISK, pick it up in our page_table */
-bool reclamation(void *vaddr, bool user, bool writable){
+bool reclamation(void *vaddr, bool user UNUSED, bool writable){
   void *upage = pg_round_down(vaddr);
   void *kpage;
   bool success;
-  struct page_entry *pe = locate_page(upage, PHYS);
-  if (user)
-    kpage = (void *)palloc_get_page(PAL_USER | PAL_ZERO);
-  else
-    kpage = (void *)palloc_get_page(PAL_ZERO);
-  if (!kpage) {
-    // swap and get kpage
-    kpage = swap_out(user?PAL_USER|PAL_ZERO:PAL_ZERO);
-  }
+  struct page_entry *pe;
+  kpage = get_frame();
+  if (kpage == NULL)
+    return 0;
+  pe = locate_page(upage, PHYS);
   swap_in(kpage, pe);
   if (!(success = install_page(upage, kpage, writable))) {
     table_free_page(upage);
-    table_free_frame(kpage);
+    palloc_free_page(kpage);
+    return success;
   }
+  /* Its contents are no longer those of its file, if any, so it
+     must go back to swap when evicted again. */
+  pagedir_set_dirty(thread_current()->pagedir, upage, 1);
+  insert_frame_table(kpage, pe);
   return success;
 }
 
 /* locate the Nomally page_entry in our sup_page_table*/
 struct page_entry *locate_page(void *vaddr, int location) {
 	struct thread *t = thread_current();
-  struct list *page_table = &t->sup_page_table;
+  struct hash *page_table = &t->sup_page_table;
   struct page_entry *pe = lookup_page(vaddr);
   if (pe) {
     pe->location = location;
     pe->lazy_loading = 0;
-    pe->is_mmap = 0;
     return pe;
   }
   pe = (struct page_entry *)calloc(1, sizeof(struct page_entry));
@@ -60,14 +122,14 @@ struct page_entry *locate_page(void *vaddr, int location) {
   pe->location = location;
   pe->lazy_loading = 0;
   pe->is_mmap = 0;
-	list_push_back(page_table, &pe->elem);
+	hash_insert(page_table, &pe->elem);
   return pe;
 }
 
 /* locate the page_entry which entered in lazy_loading(process.c) section in our sup_page_table*/
 struct page_entry *locate_lazy_page(void *vaddr, struct file *file, off_t offset, size_t page_zero_bytes, bool writable) {
   struct thread *t = thread_current();
-  struct list *page_table = &t->sup_page_table;
+  struct hash *page_table = &t->sup_page_table;
   struct page_entry *pe = lookup_page(vaddr);
   if (pe) {
     pe->location = FILE;
@@ -90,14 +152,14 @@ struct page_entry *locate_lazy_page(void *vaddr, struct file *file, off_t offset
   pe->offset = offset;
   pe->page_zero_bytes = page_zero_bytes;
   pe->writable = writable;
-  list_push_back(page_table, &pe->elem);
+  hash_insert(page_table, &pe->elem);
   return pe;
 }
 
 /* locate the page_entry which entered in mmap section(syscall.c) in our sup_page_table*/
 struct page_entry *locate_mmap_page(void *vaddr, struct file *file, off_t offset, size_t page_zero_bytes) {
   struct thread *t = thread_current();
-  struct list *page_table = &t->sup_page_table;
+  struct hash *page_table = &t->sup_page_table;
   struct page_entry *pe = lookup_page(vaddr);
   if (pe) {
     pe->location = FILE;
@@ -120,87 +182,267 @@ struct page_entry *locate_mmap_page(void *vaddr, struct file *file, off_t offset
   pe->offset = offset;
   pe->page_zero_bytes = page_zero_bytes;
   pe->writable = 1;
-  list_push_back(page_table, &pe->elem);
+  hash_insert(page_table, &pe->elem);
   return pe;
 }
 
 
 /* Update our frame_table and base_page_table after making the new_page_entry*/
-bool lazy_load_segment(void *vaddr, bool user, bool writable, struct file *file, off_t offset, size_t page_zero_bytes){
+bool lazy_load_segment(void *vaddr, bool user UNUSED, bool writable, struct file *file, off_t offset, size_t page_zero_bytes){
   void *upage = pg_round_down(vaddr);
   void *kpage;
   size_t page_read_bytes = PGSIZE - page_zero_bytes;
   struct page_entry *pe = locate_page(upage, PHYS);
 
-  file_seek(file, offset);
+  /* Read-only executable pages are shared by every process running the same program. */
+  bool shareable = !writable && file != NULL && page_read_bytes > 0;
+  pe->shared = 0;
+  if (shareable && frame_share_get(pe, file_get_inode(file), offset, page_read_bytes))
+    return 1;
 
-  /* Get a page of memory. */
-  if (user)
-    kpage = (void *)palloc_get_page (PAL_USER | PAL_ZERO);
-  else
-    kpage = (void *)palloc_get_page(PAL_ZERO);
+  /* A zero page dropped by swap_out() has no file. */
+  if (file != NULL)
+    file_seek(file, offset);
 
-  if (kpage == NULL){
-    kpage = swap_out(user?PAL_USER|PAL_ZERO:PAL_ZERO);
-  }
+  /* Get a page of memory. */
+  kpage = get_frame();
+  if (kpage == NULL)
+    {
+      table_free_page(upage);
+      return 0;
+    }
 
   /* Load this page. */
-  if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
+  if (page_read_bytes > 0 && file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
     {
       table_free_page(upage);
-      table_free_frame(kpage);
+      palloc_free_page(kpage);
       return 0;
     }
   memset (kpage + page_read_bytes, 0, page_zero_bytes);
 
-  insert_frame_table(kpage, pe);
-
   /* Add the page to the process's address space. If this action is failed, free all */
   if (!install_page(upage, kpage, writable))
     {
       table_free_page(upage);
-      table_free_frame(kpage);
+      palloc_free_page(kpage);
       return 0; 
     }
+  insert_frame_table(kpage, pe);
+  if (shareable)
+    frame_share_add(kpage, pe, file_get_inode(file), offset, page_read_bytes);
   return 1;
 }
 
-struct page_entry *lookup_page(uint32_t *vaddr) {
+/* Maps the zero page at VADDR, read-only, for a read fault on a
+   page that would be all zeros.  If WRITABLE, the first write
+   gives the page its own frame through copy_on_write(). */
+bool zero_page_map(void *vaddr, bool writable) {
   void *upage = pg_round_down(vaddr);
+  struct page_entry *pe = locate_page(upage, PHYS);
+
+  pe->writable = writable;
+  pe->shared = 0;
+  pe->cow = writable;
+  if (!install_page(upage, zero_page, 0)) {
+    table_free_page(upage);
+    return 0;
+  }
+  return 1;
+}
+
+/* Pages past a faulting lazy page that fault_around() maps. */
+#define FAULT_AROUND_PAGES 8
+
+/* Maps in up to FAULT_AROUND_PAGES lazy pages that follow the
+   just-loaded page at VADDR in the same executable segment, so a
+   sequential first pass over it takes one fault instead of one per
+   page.  Pages already in another process's frames are mapped as
+   they are; the rest are read with a single file read into
+   consecutive user pool pages.  All-zero pages are left to
+   zero_page_map().  Only free user pages are used: fault-around
+   never evicts, and its pages are left unreferenced so the clock
+   takes them back first if they go unused. */
+void fault_around(void *vaddr) {
   struct thread *t = thread_current();
-  struct list *page_table = &t->sup_page_table;
-  struct list_elem *e;
-  struct page_entry *pe = NULL;
-  struct page_entry *found = NULL;
-  for (e = list_begin(page_table); e != list_end(page_table); e = list_next(e)) {
-    pe = list_entry(e, struct page_entry, elem);
-    if (upage == pg_round_down(pe->vaddr)) {
-      found = pe;
+  uint8_t *upage = pg_round_down(vaddr);
+  struct page_entry *prev = lookup_page((uint32_t *)upage);
+  struct page_entry *run[FAULT_AROUND_PAGES];
+  size_t n = 0, read_bytes, i;
+  uint8_t *kbase;
+
+  /* Collect the run of pages to read.  Each but the last is a full
+     page, so the run is one stretch of the file. */
+  for (i = 0; prev != NULL && i < FAULT_AROUND_PAGES; i++) {
+    struct page_entry *pe;
+    size_t page_read_bytes;
+
+    upage += PGSIZE;
+    if (!is_user_vaddr(upage) || pagedir_get_page(t->pagedir, upage) != NULL)
+      break;
+    pe = lookup_page((uint32_t *)upage);
+    if (pe == NULL || pe->file == NULL || !pe->lazy_loading || pe->location != FILE
+        || pe->page_zero_bytes == PGSIZE || prev->page_zero_bytes != 0
+        || pe->file != prev->file || pe->writable != prev->writable
+        || pe->offset != prev->offset + PGSIZE)
+      break;
+
+    page_read_bytes = PGSIZE - pe->page_zero_bytes;
+    pe->shared = 0;
+    if (n > 0 || pe->writable
+        || !frame_share_get(pe, file_get_inode(pe->file), pe->offset, page_read_bytes))
+      run[n++] = pe;
+    prev = pe;
+  }
+
+  /* Take as many consecutive free pages as there are, up to N. */
+  for (kbase = NULL; n > 0; n--)
+    if ((kbase = palloc_get_multiple(PAL_USER, n)) != NULL)
+      break;
+  if (n == 0)
+    return;
+
+  read_bytes = (n - 1) * PGSIZE + (PGSIZE - run[n - 1]->page_zero_bytes);
+  if (file_read_at(run[0]->file, kbase, read_bytes, run[0]->offset) != (int) read_bytes) {
+    palloc_free_multiple(kbase, n);
+    return;
+  }
+  memset(kbase + read_bytes, 0, n * PGSIZE - read_bytes);
+
+  for (i = 0; i < n; i++) {
+    struct page_entry *pe = run[i];
+    uint8_t *kpage = kbase + i * PGSIZE;
+
+    if (!install_page(pe->vaddr, kpage, pe->writable)) {
+      palloc_free_multiple(kpage, n - i);
       break;
     }
+    pe->location = PHYS;
+    pe->lazy_loading = 0;
+    insert_frame_table(kpage, pe);
+    if (!pe->writable)
+      frame_share_add(kpage, pe, file_get_inode(pe->file), pe->offset, PGSIZE - pe->page_zero_bytes);
   }
-  return found;
 }
 
-bool stack_growth(void *vaddr, bool user, bool writable){
+/* Finds the current thread's page_entry for the page holding VADDR, or returns NULL. */
+struct page_entry *lookup_page(uint32_t *vaddr) {
+  struct page_entry key;
+  struct hash_elem *e;
+  key.vaddr = pg_round_down(vaddr);
+  e = hash_find(&thread_current()->sup_page_table, &key.elem);
+  return e != NULL ? hash_entry(e, struct page_entry, elem) : NULL;
+}
+
+bool stack_growth(void *vaddr, bool user UNUSED, bool writable){
   void *upage = pg_round_down(vaddr);
   struct thread *cur = thread_current();
   // allocate a page from a USER_POOL, and add an entry to frame_table
-  void* frame = palloc_get_page(user?PAL_USER|PAL_ZERO:PAL_ZERO);
+  void* frame = palloc_get_page(PAL_USER | PAL_ZERO);
   if(frame == NULL){
     return 0;
   }
   else{
     struct page_entry *pe = locate_page(upage, PHYS);
-    insert_frame_table(frame, pe);
+    pe->writable = writable;
     //add the page to the process's address space
     if(!pagedir_set_page(cur->pagedir, upage, frame, writable)){
       //free the frame - set failure
       table_free_page(upage);
-      table_free_frame(frame);
+      palloc_free_page(frame);
+      return 0;
+    }
+    insert_frame_table(frame, pe);
+  }
+  return 1;
+}
+
+/* Copies PARENT's supplemental page table into the current thread's
+   for fork().  Resident pages are shared: read-only ones as they are,
+   writable ones copy-on-write in both processes.  A page on swap is
+   read into a private frame, since a slot has a single owner.  Memory
+   mappings and shared memory segments are not inherited.  PARENT is
+   blocked until we are done, but its pages may still be evicted. */
+bool page_table_fork(struct thread *parent) {
+  struct thread *t = thread_current();
+  struct hash_iterator i;
+
+  hash_first(&i, &parent->sup_page_table);
+  while (hash_next(&i)) {
+    struct page_entry *ppe = hash_entry(hash_cur(&i), struct page_entry, elem);
+    struct page_entry *pe;
+    void *kpage;
+    bool success;
+
+    if (ppe->is_mmap || ppe->location == SHM)
+      continue;
+    pe = malloc(sizeof *pe);
+    if (pe == NULL)
+      return 0;
+    /* Settles where the page is and copies it, sharing a resident
+       one. */
+    success = frame_share_ref(parent, ppe, pe);
+    if (pe->file != NULL && pe->file == parent->execute_f)
+      pe->file = t->execute_f;
+    hash_insert(&t->sup_page_table, &pe->elem);
+    if (!success)
+      return 0;
+
+    if (pe->location == DISK) {
+      /* A swap slot has a single owner. */
+      pe->location = FILE;
+      kpage = get_frame();
+      if (kpage == NULL)
+        return 0;
+      read_block(kpage, ppe->swap_index);
+      if (!pagedir_set_page(t->pagedir, pe->vaddr, kpage, pe->writable)) {
+        palloc_free_page(kpage);
+        return 0;
+      }
+      pe->location = PHYS;
+      pagedir_set_dirty(t->pagedir, pe->vaddr, 1);
+      insert_frame_table(kpage, pe);
+    }
+  }
+  return 1;
+}
+
+/* Gives the current thread a writable page at VADDR if it is a
+   copy-on-write page: the frame itself once no other process maps
+   it, or else a private copy.  Returns false if VADDR is no such
+   page. */
+bool copy_on_write(void *vaddr) {
+  void *upage = pg_round_down(vaddr);
+  uint32_t *pd = thread_current()->pagedir;
+  struct page_entry *pe = lookup_page(upage);
+  void *copy;
+
+  if (pe == NULL)
+    return 0;
+  /* Its frame may be on its way out; then just fault again. */
+  frame_wait(pe);
+  if (pe->location != PHYS)
+    return pagedir_get_page(pd, upage) == NULL;
+  if (!pe->cow)
+    return 0;
+  /* Neither process's file holds these contents any more, so the
+     page is dirty from here on.  get_frame() zeroes the copy. */
+  copy = get_frame();
+  if (copy == NULL)
+    return 0;
+  if (pagedir_get_page(pd, upage) == zero_page) {
+    pagedir_clear_page(pd, upage);
+    if (!pagedir_set_page(pd, upage, copy, 1)) {
+      table_free_page(upage);
+      palloc_free_page(copy);
       return 0;
     }
+    pagedir_set_dirty(pd, upage, 1);
+    insert_frame_table(copy, pe);
+    pe->cow = 0;
   }
+  else if (!frame_share_own(pe, copy))
+    palloc_free_page(copy);
   return 1;
 }
 
@@ -209,7 +451,7 @@ void table_free_page(void *vaddr) {
     return;
   void *upage = pg_round_down(vaddr);
   struct page_entry *pe = lookup_page(upage);
-  list_remove(&pe->elem);
+  hash_delete(&thread_current()->sup_page_table, &pe->elem);
   free(pe);
 }
 
@@ -1,4 +1,4 @@
-#include <list.h>
+#include <hash.h>
 #include "filesys/file.h"
 #include "threads/thread.h"
 #include "userprog/syscall.h"
@@ -6,6 +6,7 @@
 #define PHYS 0
 #define DISK 1
 #define FILE 2
+#define SHM 3                       /* In a shared memory segment. */
 
 #define ALL_ZERO 0
 #define EXE_FILE 1
@@ -14,7 +15,7 @@ struct page_entry {
 	uint32_t* vaddr;
 	bool dirty;
 	bool access;
-	struct list_elem elem;
+	struct hash_elem elem;              /* Element in sup_page_table. */
 	int location;
 	// lazy_loading
 	bool lazy_loading;
@@ -25,9 +26,23 @@ struct page_entry {
 	off_t offset;
 	size_t page_zero_bytes;
 	bool writable;
+	bool shared;                        /* Maps a shared frame; guarded by */
+	                                    /* frame_table_lock. */
+	struct thread *owner;               /* Its process, while shared. */
+	struct list_elem share_elem;        /* In its frame's sharers, while shared. */
+	bool cow;                           /* Shared with a fork()ed process until written. */
+	bool evicting;                      /* Its frame is being evicted; guarded */
+	                                    /* by frame_table_lock. */
+	// swap
+	int swap_index;                     /* First sector of its slot, if on DISK. */
+	// shared memory
+	struct shm_handle *shm;             /* Mapping it belongs to, if in SHM. */
 };
 
-void page_init(struct list *list);
+void zero_page_init(void);
+bool page_init(struct hash *page_table);
+void *get_frame(void);
+void page_destroy(struct hash *page_table);
 bool reclamation(void *vaddr, bool user, bool writable);
 struct page_entry *locate_page(void *vaddr, int location);
 struct page_entry *locate_lazy_page(void *vaddr, struct file *file, off_t offset, size_t page_zero_bytes, bool writable);
@@ -35,4 +50,8 @@ struct page_entry *locate_mmap_page(void *vaddr, struct file *file, off_t offset
 bool lazy_load_segment(void *vaddr, bool user, bool writable, struct file *file, off_t offset, size_t page_zero_bytes);
 struct page_entry *lookup_page(uint32_t *vaddr);
 bool stack_growth(void *vaddr, bool user, bool writable);
+bool zero_page_map(void *vaddr, bool writable);
+void fault_around(void *vaddr);
 void table_free_page(void *vaddr);
+bool page_table_fork(struct thread *parent);
+bool copy_on_write(void *vaddr);
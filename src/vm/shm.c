@@ -0,0 +1,327 @@
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+
+/* One page of a segment: resident in KPAGE, on swap at
+   SWAP_INDEX, or neither while it is still all zeros. */
+struct shm_page {
+	struct shm_segment *seg;
+	void *kpage;
+	int swap_index;             /* First sector of its slot, or -1. */
+};
+
+/* A named segment of shared anonymous memory.  It lives while any
+   process has a handle on it, and keeps its contents while any
+   process has it mapped: the last detach frees its pages, and a
+   later attach sees zeros. */
+struct shm_segment {
+	char name[SHM_NAME_MAX + 1];
+	size_t page_cnt;
+	struct shm_page *pages;
+	int open_cnt;               /* Handles on it. */
+	int map_cnt;                /* Handles that map it. */
+	struct list maps;           /* shm_handles that map it. */
+	struct list_elem elem;      /* Element in segments. */
+};
+
+/* Every segment, with their pages and maps, guarded by shm_lock. */
+static struct list segments;
+static struct lock shm_lock;
+
+static struct shm_segment *lookup_segment(const char *name);
+static struct shm_segment *page_segment(struct shm_page *sp);
+static void release_pages(struct shm_segment *seg);
+static struct shm_handle *lookup_handle(int shmid);
+static void unmap_handle(struct shm_handle *h);
+
+void shm_init(void) {
+	list_init(&segments);
+	lock_init(&shm_lock);
+}
+
+/* Opens the segment called NAME, creating it with SIZE bytes if
+   there is none, and returns a new handle's shmid, or -1 if NAME
+   is invalid or an existing segment is smaller than SIZE. */
+int shm_get(const char *name, size_t size) {
+	struct thread *t = thread_current();
+	size_t page_cnt = DIV_ROUND_UP(size, PGSIZE);
+	struct shm_segment *seg;
+	struct shm_handle *h;
+	struct list_elem *e;
+	int shmid = 0;
+	size_t i;
+
+	if (name[0] == '\0' || strlen(name) > SHM_NAME_MAX || page_cnt == 0)
+		return -1;
+	for (e = list_begin(&t->shm_table); e != list_end(&t->shm_table); e = list_next(e)) {
+		h = list_entry(e, struct shm_handle, elem);
+		if (h->shmid >= shmid)
+			shmid = h->shmid + 1;
+	}
+	h = calloc(1, sizeof *h);
+	if (h == NULL)
+		return -1;
+
+	lock_acquire(&shm_lock);
+	seg = lookup_segment(name);
+	if (seg == NULL) {
+		seg = malloc(sizeof *seg);
+		if (seg != NULL && (seg->pages = calloc(page_cnt, sizeof *seg->pages)) == NULL) {
+			free(seg);
+			seg = NULL;
+		}
+		if (seg != NULL) {
+			strlcpy(seg->name, name, sizeof seg->name);
+			seg->page_cnt = page_cnt;
+			seg->open_cnt = 0;
+			seg->map_cnt = 0;
+			for (i = 0; i < page_cnt; i++) {
+				seg->pages[i].seg = seg;
+				seg->pages[i].swap_index = -1;
+			}
+			list_init(&seg->maps);
+			list_push_back(&segments, &seg->elem);
+		}
+	}
+	else if (seg->page_cnt < page_cnt)
+		seg = NULL;
+	if (seg != NULL)
+		seg->open_cnt++;
+	lock_release(&shm_lock);
+
+	if (seg == NULL) {
+		free(h);
+		return -1;
+	}
+	h->shmid = shmid;
+	h->seg = seg;
+	h->owner = t;
+	list_push_back(&t->shm_table, &h->elem);
+	return shmid;
+}
+
+/* Maps the segment of the current thread's handle SHMID at ADDR,
+   a page-aligned user address.  Its pages are brought in on the
+   first fault.  Returns false if the handle is already mapped or
+   any page in the range is in use. */
+bool shm_attach(int shmid, void *addr) {
+	struct thread *t = thread_current();
+	struct shm_handle *h = lookup_handle(shmid);
+	uint8_t *upage;
+	size_t i;
+
+	if (h == NULL || h->addr != NULL || addr == NULL || pg_ofs(addr) != 0)
+		return 0;
+	for (i = 0; i < h->seg->page_cnt; i++) {
+		upage = (uint8_t *) addr + i * PGSIZE;
+		if (!is_user_vaddr(upage) || lookup_page((uint32_t *) upage) != NULL
+		    || pagedir_get_page(t->pagedir, upage) != NULL)
+			return 0;
+	}
+	for (i = 0; i < h->seg->page_cnt; i++) {
+		struct page_entry *pe = locate_page((uint8_t *) addr + i * PGSIZE, SHM);
+		pe->shm = h;
+		pe->writable = 1;
+	}
+
+	lock_acquire(&shm_lock);
+	h->addr = addr;
+	list_push_back(&h->seg->maps, &h->map_elem);
+	h->seg->map_cnt++;
+	lock_release(&shm_lock);
+	return 1;
+}
+
+/* Unmaps the current thread's handle SHMID, if it is mapped.  The
+   segment keeps its contents only if another process maps it. */
+void shm_detach(int shmid) {
+	struct shm_handle *h = lookup_handle(shmid);
+	if (h != NULL && h->addr != NULL)
+		unmap_handle(h);
+}
+
+/* Unmaps and closes every handle of the current thread, freeing
+   each segment that no process has open any more.  Must run
+   before its page directory is destroyed. */
+void shm_exit(void) {
+	struct list *shm_table = &thread_current()->shm_table;
+	while (!list_empty(shm_table)) {
+		struct shm_handle *h = list_entry(list_pop_front(shm_table), struct shm_handle, elem);
+		struct shm_segment *seg = h->seg;
+		if (h->addr != NULL)
+			unmap_handle(h);
+		lock_acquire(&shm_lock);
+		if (--seg->open_cnt == 0) {
+			list_remove(&seg->elem);
+			free(seg->pages);
+			free(seg);
+		}
+		lock_release(&shm_lock);
+		free(h);
+	}
+}
+
+/* Maps the page PE of a segment into the current thread, reading
+   it back from swap or giving it a zeroed frame if it is not
+   resident. */
+bool shm_fault(struct page_entry *pe) {
+	struct shm_handle *h = pe->shm;
+	struct shm_page *sp = &h->seg->pages[pg_no(pe->vaddr) - pg_no(h->addr)];
+	void *kpage = NULL;
+	bool success;
+
+	lock_acquire(&shm_lock);
+	while (sp->kpage == NULL && kpage == NULL) {
+		/* get_frame() may have to evict a segment page. */
+		lock_release(&shm_lock);
+		kpage = get_frame();
+		lock_acquire(&shm_lock);
+		if (kpage == NULL && sp->kpage == NULL) {
+			lock_release(&shm_lock);
+			return 0;
+		}
+	}
+	if (sp->kpage == NULL) {
+		if (sp->swap_index >= 0) {
+			read_block(kpage, sp->swap_index);
+			swap_free(sp->swap_index);
+			sp->swap_index = -1;
+		}
+		sp->kpage = kpage;
+		frame_shm_insert(kpage, sp);
+		kpage = NULL;
+	}
+	success = pagedir_set_page(thread_current()->pagedir, pe->vaddr, sp->kpage, 1);
+	lock_release(&shm_lock);
+
+	/* Another process brought the page in first. */
+	if (kpage != NULL)
+		palloc_free_page(kpage);
+	return success;
+}
+
+/* Evicts FE, a segment page chosen by pop_frame(), by unmapping it
+   from every process and writing it to swap.  If any of them used
+   it since the last look, it gets a second chance instead: FE goes
+   back in the frame table and false is returned. */
+bool shm_evict(struct frame_entry *fe) {
+	struct shm_page *sp = fe->shm;
+	struct shm_segment *seg;
+	size_t ofs;
+	bool accessed = 0;
+	struct list_elem *e;
+
+	lock_acquire(&shm_lock);
+	/* The last detach may have released the page meanwhile, and
+	   left its frame to us. */
+	seg = page_segment(sp);
+	if (seg == NULL || sp->kpage != fe->frame) {
+		lock_release(&shm_lock);
+		palloc_free_page(fe->frame);
+		return 1;
+	}
+	ofs = (sp - seg->pages) * PGSIZE;
+	for (e = list_begin(&seg->maps); e != list_end(&seg->maps); e = list_next(e)) {
+		struct shm_handle *h = list_entry(e, struct shm_handle, map_elem);
+		if (pagedir_is_accessed(h->owner->pagedir, (uint8_t *) h->addr + ofs)) {
+			pagedir_set_accessed(h->owner->pagedir, (uint8_t *) h->addr + ofs, 0);
+			accessed = 1;
+		}
+	}
+	if (accessed) {
+		frame_shm_insert(fe->frame, sp);
+		lock_release(&shm_lock);
+		return 0;
+	}
+	for (e = list_begin(&seg->maps); e != list_end(&seg->maps); e = list_next(e)) {
+		struct shm_handle *h = list_entry(e, struct shm_handle, map_elem);
+		pagedir_clear_page(h->owner->pagedir, (uint8_t *) h->addr + ofs);
+	}
+	sp->swap_index = swap_write_page(fe->frame);
+	sp->kpage = NULL;
+	lock_release(&shm_lock);
+
+	palloc_free_page(fe->frame);
+	return 1;
+}
+
+/* Returns the segment called NAME, or NULL.  Must be called with
+   shm_lock held. */
+static struct shm_segment *lookup_segment(const char *name) {
+	struct list_elem *e;
+	for (e = list_begin(&segments); e != list_end(&segments); e = list_next(e)) {
+		struct shm_segment *seg = list_entry(e, struct shm_segment, elem);
+		if (!strcmp(seg->name, name))
+			return seg;
+	}
+	return NULL;
+}
+
+/* Returns the segment that SP, a page that may have been freed,
+   still belongs to, or NULL.  Must be called with shm_lock held. */
+static struct shm_segment *page_segment(struct shm_page *sp) {
+	struct list_elem *e;
+	for (e = list_begin(&segments); e != list_end(&segments); e = list_next(e)) {
+		struct shm_segment *seg = list_entry(e, struct shm_segment, elem);
+		if (sp >= seg->pages && sp < seg->pages + seg->page_cnt)
+			return seg;
+	}
+	return NULL;
+}
+
+/* Frees every page of SEG, resident or on swap.  A frame that
+   pop_frame() has already chosen is left to shm_evict().  Must be
+   called with shm_lock held, once no process maps SEG. */
+static void release_pages(struct shm_segment *seg) {
+	size_t i;
+	for (i = 0; i < seg->page_cnt; i++) {
+		struct shm_page *sp = &seg->pages[i];
+		if (sp->kpage != NULL && frame_shm_remove(sp->kpage))
+			palloc_free_page(sp->kpage);
+		sp->kpage = NULL;
+		if (sp->swap_index >= 0)
+			swap_free(sp->swap_index);
+		sp->swap_index = -1;
+	}
+}
+
+/* Returns the current thread's handle SHMID, or NULL. */
+static struct shm_handle *lookup_handle(int shmid) {
+	struct list *shm_table = &thread_current()->shm_table;
+	struct list_elem *e;
+	for (e = list_begin(shm_table); e != list_end(shm_table); e = list_next(e)) {
+		struct shm_handle *h = list_entry(e, struct shm_handle, elem);
+		if (h->shmid == shmid)
+			return h;
+	}
+	return NULL;
+}
+
+/* Removes the current thread's mapping of H from its page table
+   and from the segment, whose pages are freed if no other process
+   maps it. */
+static void unmap_handle(struct shm_handle *h) {
+	uint32_t *pd = thread_current()->pagedir;
+	size_t i;
+
+	lock_acquire(&shm_lock);
+	list_remove(&h->map_elem);
+	for (i = 0; i < h->seg->page_cnt; i++) {
+		uint8_t *upage = (uint8_t *) h->addr + i * PGSIZE;
+		pagedir_clear_page(pd, upage);
+		table_free_page(upage);
+	}
+	h->addr = NULL;
+	if (--h->seg->map_cnt == 0)
+		release_pages(h->seg);
+	lock_release(&shm_lock);
+}
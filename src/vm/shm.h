@@ -0,0 +1,34 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/thread.h"
+
+struct frame_entry;
+struct page_entry;
+
+/* Longest shared memory segment name. */
+#define SHM_NAME_MAX 14
+
+/* A process's handle on a shared memory segment, in its
+   shm_table.  Each handle maps the segment at most once. */
+struct shm_handle {
+	int shmid;
+	struct shm_segment *seg;
+	struct thread *owner;
+	void *addr;                 /* Where it is mapped, or NULL. */
+	struct list_elem elem;      /* Element in owner's shm_table. */
+	struct list_elem map_elem;  /* Element in seg's maps, if mapped. */
+};
+
+void shm_init(void);
+int shm_get(const char *name, size_t size);
+bool shm_attach(int shmid, void *addr);
+void shm_detach(int shmid);
+void shm_exit(void);
+bool shm_fault(struct page_entry *pe);
+bool shm_evict(struct frame_entry *fe);
+
+#endif /* vm/shm.h */
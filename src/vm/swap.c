@@ -1,138 +1,211 @@
+#include <bitmap.h>
+#include <debug.h>
 #include <list.h>
 #include <stdio.h>
 #include "vm/frame.h"
 #include "vm/swap.h"
 #include "vm/page.h"
+#include "vm/shm.h"
 #include "devices/block.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "userprog/pagedir.h"
 #include "threads/palloc.h"
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+#include "filesys/file.h"
+#include "devices/timer.h"
 
 static struct block *swap_block;
-static struct lock swap_block_lock;
-static struct list swap_table;
-static struct lock swap_table_lock;
-static bool sort(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+static struct lock swap_slot_lock;
+
+/* Sectors per swap slot; one slot holds one page. */
+#define SLOT_SECTORS 8
+
+/* One bit per swap slot, set if in use.  Allocation is next-fit,
+   starting from swap_hint.  Both are guarded by swap_slot_lock. */
+static struct bitmap *swap_slots;
+static size_t swap_hint;
+
+/* The pageout thread keeps at least this many user pages free,
+   or a quarter of the pool if that is smaller, so that a fault
+   rarely waits for a victim's write before its own read. */
+#define PAGEOUT_FREE_PAGES 16
+
 static int allocate_index(void);
+static bool evict_frame(void);
+static void evict_shared(struct frame_entry *fe);
+static void pageout_daemon(void *aux UNUSED);
 
 void swap_init(void) {
 	swap_block = block_get_role(BLOCK_SWAP);
-	list_init(&swap_table);
-	lock_init(&swap_block_lock);
-	lock_init(&swap_table_lock);
+	swap_slots = bitmap_create(swap_block != NULL ? block_size(swap_block) / SLOT_SECTORS : 0);
+	if (swap_slots == NULL)
+		PANIC("can't allocate swap slot bitmap");
+	swap_hint = 0;
+	lock_init(&swap_slot_lock);
+	if (swap_block != NULL)
+		thread_create("_pageout", PRI_DEFAULT, pageout_daemon, NULL);
 }
 
-/* If frame is full, we choose the evition and swap it in DISK. We use the FIFO algorithm */
+/* Evicts frames ahead of demand, writing dirty victims out in the
+   background, whenever free user pages run short. */
+static void pageout_daemon(void *aux UNUSED){
+	size_t target = frame_total_cnt() / 4;
+	if (target > PAGEOUT_FREE_PAGES)
+		target = PAGEOUT_FREE_PAGES;
+	while(1){
+		timer_sleep(TIMER_FREQ / 20);
+		while (frame_free_cnt() < target && evict_frame())
+			continue;
+	}
+}
+
+/* If frame is full, we evict one and allocate a new page with FLAGS, again if another thread takes the freed page first.
+   Normally the pageout thread has already freed pages, so this is only reached when it falls behind.
+   Returns NULL if there is nothing left to evict, every frame being in transit. */
 void* swap_out(enum palloc_flags flags){
+  void *kpage = NULL;
+  while (kpage == NULL && evict_frame())
+    kpage = palloc_get_page(flags);
+  return kpage != NULL ? kpage : palloc_get_page(flags);
+}
 
-	//Choose the frame evicted following the FIFO algoritm(Swap out)
+/* Chooses a victim by the clock algorithm in pop_frame() and frees its frame.
+   Only a dirty anonymous or executable page goes to the swap disk: a clean one is dropped and read back from its file
+   (or zero-filled) on the next fault, and a dirty mmap page is written back to its own file.
+   The victim may belong to another process, which waits for us in frame_wait() or frame_exit() meanwhile,
+   or be shared by several.  Returns false if no frame could be chosen. */
+static bool evict_frame(void){
+
+	//Choose the frame evicted following the clock algorithm(Swap out)
 	struct frame_entry *fe = pop_frame();
-  
-  struct swap_entry *se = (struct swap_entry *)calloc(1, sizeof(struct swap_entry));
-  struct thread *t = thread_current();
-
-  se->frame = fe->frame;
-  fe->pe->location = DISK;
-  se->pe = fe->pe;
-  se->owner = fe->owner;
-
-  //push the frame in the swap_table
-	lock_acquire(&swap_block_lock);
-  se->index = allocate_index();
-  write_block((void *)fe->frame, se->index);
-	lock_release(&swap_block_lock);
-  push_swap(se);
-  
-  //free the original frame which choose as the evition
-  pagedir_clear_page(t->pagedir, fe->pe->vaddr);
-  palloc_free_page(fe->frame);
-  free(fe);
-
-  //And allocate the new_page
-  void* page = palloc_get_page(flags);
-  
-  return page;
-}
+  struct page_entry *pe;
+  uint32_t *pd;
+  void *frame;
+  enum intr_level old_level;
+  bool dirty;
+
+  //a shared memory page is unmapped from all its processes by shm_evict(), which may pass it over
+  while (fe != NULL && fe->shm != NULL) {
+    if (shm_evict(fe))
+      return 1;
+    fe = pop_frame();
+  }
+  if (fe == NULL)
+    return 0;
+  if (fe->ref_cnt > 0) {
+    evict_shared(fe);
+    frame = fe->frame;
+    frame_evict_done(fe);
+    palloc_free_page(frame);
+    return 1;
+  }
+  pe = fe->pe;
+  pd = fe->owner->pagedir;
+
+  //pop_frame() marked the page in transit, so its owner can't fault it back in or free it under us;
+  //unmap it first so the owner faults instead of writing to it during swap out
+  old_level = intr_disable();
+  dirty = pagedir_is_dirty(pd, pe->vaddr);
+  pagedir_clear_page(pd, pe->vaddr);
+  intr_set_level(old_level);
+
+  if (pe->is_mmap) {
+    if (dirty)
+      file_write_at(pe->file, fe->frame, PGSIZE - pe->page_zero_bytes, pe->offset);
+    pe->location = FILE;
+  }
+  else if (!dirty) {
+    //reload it lazily; a page without a file is all zeros
+    if (pe->file == NULL) {
+      pe->page_zero_bytes = PGSIZE;
+      pe->writable = 1;
+    }
+    pe->location = FILE;
+    pe->lazy_loading = 1;
+  }
+  else {
+    //the page_entry remembers its slot until swap_in; it is only published once the write is done
+    int index = swap_write_page(fe->frame);
+    pe->swap_index = index;
+    pe->location = DISK;
+  }
 
-void swap_in(void* frame, struct page_entry *pe){
-	struct swap_entry *se = lookup_swap(pe->vaddr);
-	read_block((void *)frame, se->index);
-	// TODO: locate_page
-  insert_frame_table(frame, pe);
-  lock_acquire(&swap_table_lock);
-  list_remove(&se->elem);
-  lock_release(&swap_table_lock);
-  free(se);
+  //free the original frame which choose as the evition, once the owner may look at the page again
+  frame = fe->frame;
+  frame_evict_done(fe);
+  palloc_free_page(frame);
+  return 1;
 }
 
-void read_block(void *frame, int index) {
-	int i;
-	lock_acquire(&swap_block_lock);
-	for (i = 0; i < 8; i++) {
-		block_read(swap_block, index + i, (void *)frame + (i * BLOCK_SECTOR_SIZE));
-	}
-	lock_release(&swap_block_lock);
-}
+/* Evicts FE, a frame shared by several processes, by unmapping it from each of them.  A read-only executable
+   page is clean, so every page is simply reread from its file on the next fault.  A copy-on-write page is
+   written to swap once for each process, since a slot has a single owner; each then swaps in a private copy. */
+static void evict_shared(struct frame_entry *fe) {
+  struct list_elem *e;
 
-void write_block(void *frame, int index) {
-	int i;
-	for (i = 0; i < 8; i++) {
-		block_write(swap_block, index + i, (void *)frame + (i * BLOCK_SECTOR_SIZE));
-	}
+  for (e = list_begin(&fe->sharers); e != list_end(&fe->sharers); e = list_next(e)) {
+    struct page_entry *pe = list_entry(e, struct page_entry, share_elem);
+    pagedir_clear_page(pe->owner->pagedir, pe->vaddr);
+    if (fe->inode != NULL) {
+      pe->location = FILE;
+      pe->lazy_loading = 1;
+    }
+    else {
+      pe->swap_index = swap_write_page(fe->frame);
+      pe->location = DISK;
+      pe->cow = 0;
+    }
+    pe->shared = 0;
+  }
 }
 
-void push_swap(struct swap_entry *se) {
-	lock_acquire(&swap_table_lock);
-	list_push_back(&swap_table, &se->elem);
-	lock_release(&swap_table_lock);
+/* Reads PE's page back from swap into FRAME and frees its slot.
+   The caller maps FRAME and then adds it to the frame table. */
+void swap_in(void* frame, struct page_entry *pe){
+	read_block((void *)frame, pe->swap_index);
+  swap_free(pe->swap_index);
 }
 
-struct swap_entry *pop_swap(void) {
-	lock_acquire(&swap_table_lock);
-	struct swap_entry *se = list_entry(list_pop_front(&swap_table), struct swap_entry, elem);
-	lock_release(&swap_table_lock);
-	return se;
+/* Reads the page at sector INDEX with a single disk command.
+   Swap transfers are not serialized here: each slot has one user,
+   and the IDE channel queues concurrent requests and orders them
+   with its elevator. */
+void read_block(void *frame, int index) {
+	block_read_multi(swap_block, index, frame, SLOT_SECTORS);
 }
 
-struct swap_entry *lookup_swap(void* vaddr){
-  struct swap_entry *se = NULL;
-  struct swap_entry *found = NULL;
-  struct list_elem *e;
-
-  lock_acquire(&swap_table_lock);
-  for(e = list_begin(&swap_table); e != list_end(&swap_table); e  = list_next(e)){
-  	se = list_entry(e, struct swap_entry, elem);
-  	if(se->pe->vaddr == vaddr){
-  		found = se;
-  		break;
-  	}
-  }
-  lock_release(&swap_table_lock);
+void write_block(void *frame, int index) {
+	block_write_multi(swap_block, index, frame, SLOT_SECTORS);
+}
 
-  return found;
+/* Writes FRAME to a newly claimed swap slot and returns the slot's
+   first sector. */
+int swap_write_page(void *frame) {
+	int index = allocate_index();
+	write_block(frame, index);
+	return index;
 }
 
+/* Claims a free swap slot and returns its first sector.  Scans
+   from just past the last slot handed out, wrapping around once. */
 static int allocate_index(void){
-	int index = 0;
-	struct list_elem *e;
-	struct swap_entry *se = NULL;
-	lock_acquire(&swap_table_lock);
-	list_sort(&swap_table, &sort, NULL);
-	for(e = list_begin(&swap_table); e != list_end(&swap_table); e = list_next(e)){
-		se = list_entry(e, struct swap_entry, elem);
-		if(se->index == index){
-			index += 8;
-			continue;
-		}
-		break;
-	}
-	lock_release(&swap_table_lock);
-	return index;
+	size_t slot;
+	lock_acquire(&swap_slot_lock);
+	slot = bitmap_scan_and_flip(swap_slots, swap_hint, 1, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip(swap_slots, 0, 1, false);
+	if (slot == BITMAP_ERROR)
+		PANIC("swap is full");
+	swap_hint = slot + 1;
+	lock_release(&swap_slot_lock);
+	return slot * SLOT_SECTORS;
 }
 
-static bool sort(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-	struct swap_entry *se_a = list_entry(a, struct swap_entry, elem);
-	struct swap_entry *se_b = list_entry(b, struct swap_entry, elem);
-	return se_a->index < se_b->index;
+/* Returns the swap slot starting at sector INDEX to the free pool. */
+void swap_free(int index){
+	lock_acquire(&swap_slot_lock);
+	bitmap_reset(swap_slots, index / SLOT_SECTORS);
+	lock_release(&swap_slot_lock);
 }
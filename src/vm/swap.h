@@ -1,21 +1,12 @@
-#include <list.h>
 #include "threads/thread.h"
 #include "threads/palloc.h"
 
-struct swap_entry
-{
-	uint32_t* frame;
-	struct thread* owner;
-	struct page_entry* pe;
-	struct list_elem elem;
-	int index;
-};
+struct page_entry;
 
 void swap_init(void);
 void* swap_out(enum palloc_flags);
 void swap_in(void* frame, struct page_entry *pe);
 void read_block(void *frame, int index);
 void write_block(void *frame, int index);
-void push_swap(struct swap_entry *se);
-struct swap_entry *pop_swap(void);
-struct swap_entry *lookup_swap(void* vaddr);
+void swap_free(int index);
+int swap_write_page(void *frame);